@@ -0,0 +1,260 @@
+#include "artifact_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <utility>
+
+#include "sha256.h"
+#include "logger.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  bool HashFile(const fs::path& path, Sha256& hash)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+      hash.Update(buffer, static_cast<size_t>(file.gcount()));
+    return !file.bad();
+  }
+
+  bool Reflink(const fs::path& from, const fs::path& to)
+  {
+#if defined(__linux__) && defined(FICLONE)
+    int src = open(from.c_str(), O_RDONLY);
+    if (src < 0) return false;
+    int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0)
+    {
+      close(src);
+      return false;
+    }
+
+    bool cloned = ioctl(dst, FICLONE, src) == 0;
+    close(src);
+    close(dst);
+    if (!cloned)
+    {
+      std::error_code ec;
+      fs::remove(to, ec);
+    }
+    return cloned;
+#else
+    (void)from;
+    (void)to;
+    return false;
+#endif
+  }
+
+  // reflink shares blocks copy-on-write, a hard link shares the inode and a
+  // plain copy is the fallback across filesystems
+  bool CloneFile(const fs::path& from, const fs::path& to, bool allow_hard_link)
+  {
+    std::error_code ec;
+    fs::remove(to, ec);
+
+    bool cloned = Reflink(from, to);
+    if (!cloned && allow_hard_link)
+    {
+      fs::create_hard_link(from, to, ec);
+      cloned = !ec;
+    }
+    if (!cloned)
+    {
+      ec.clear();
+      fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+      cloned = !ec;
+    }
+    if (cloned)
+      fs::permissions(to, fs::status(from, ec).permissions(), ec);
+    return cloned;
+  }
+
+  uint64_t DirectorySize(const fs::path& dir)
+  {
+    uint64_t size = 0;
+    std::error_code ec;
+    for (const fs::directory_entry& entry : fs::recursive_directory_iterator(dir, ec))
+      if (entry.is_regular_file(ec))
+        size += entry.file_size(ec);
+    return size;
+  }
+}
+
+ArtifactCache::ArtifactCache(fs::path root, uint64_t max_bytes)
+  : root_(std::move(root))
+  , max_bytes_(max_bytes)
+{}
+
+fs::path ArtifactCache::EntryPath(const std::string& key) const
+{
+  return root_ / key.substr(0, 2) / key;
+}
+
+std::optional<std::string> ArtifactCache::ComputeKey(const std::vector<std::string>& commands,
+                                                     const std::vector<fs::path>& inputs) const
+{
+  Sha256 hash;
+  for (const std::string& command : commands)
+  {
+    hash.Update(command);
+    hash.Update("\n", 1);
+  }
+
+  std::error_code ec;
+  for (const fs::path& input : inputs)
+  {
+    hash.Update(input.string());
+    hash.Update("\0", 1);
+
+    if (fs::is_directory(input, ec))
+      continue;
+    if (!HashFile(input, hash))
+      return std::nullopt;
+  }
+  return hash.HexDigest();
+}
+
+bool ArtifactCache::Restore(const std::string& key, const std::vector<fs::path>& outputs)
+{
+  fs::path entry = EntryPath(key);
+  std::error_code ec;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!fs::is_directory(entry, ec))
+  {
+    misses_++;
+    return false;
+  }
+
+  for (size_t i = 0; i < outputs.size(); ++i)
+  {
+    if (outputs[i].has_parent_path())
+      fs::create_directories(outputs[i].parent_path(), ec);
+    if (!CloneFile(entry / std::to_string(i), outputs[i], true))
+    {
+      misses_++;
+      return false;
+    }
+  }
+
+  // restored files must look newer than their prerequisites, and the entry
+  // mtime doubles as its LRU timestamp
+  auto now = fs::file_time_type::clock::now();
+  for (const fs::path& output : outputs)
+    fs::last_write_time(output, now, ec);
+  fs::last_write_time(entry, now, ec);
+
+  hits_++;
+  return true;
+}
+
+void ArtifactCache::Store(const std::string& key, const std::vector<fs::path>& outputs)
+{
+  fs::path entry = EntryPath(key);
+  fs::path staging = entry;
+  staging += ".tmp";
+  std::error_code ec;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fs::exists(entry, ec))
+    return;
+
+  fs::remove_all(staging, ec);
+  fs::create_directories(staging, ec);
+  if (ec) return;
+
+  uint64_t entry_bytes = 0;
+  for (size_t i = 0; i < outputs.size(); ++i)
+  {
+    if (!fs::is_regular_file(outputs[i], ec) || !CloneFile(outputs[i], staging / std::to_string(i), false))
+    {
+      fs::remove_all(staging, ec);
+      return;
+    }
+    entry_bytes += fs::file_size(outputs[i], ec);
+  }
+
+  // a rename publishes the entry atomically for concurrent builds
+  fs::rename(staging, entry, ec);
+  if (ec)
+  {
+    fs::remove_all(staging, ec);
+    return;
+  }
+
+  stores_++;
+  if (!total_bytes_)
+    total_bytes_ = DirectorySize(root_);
+  else
+    *total_bytes_ += entry_bytes;
+
+  if (*total_bytes_ > max_bytes_)
+    EvictLocked();
+}
+
+void ArtifactCache::DetachOutputs(const std::vector<fs::path>& outputs)
+{
+  std::error_code ec;
+  for (const fs::path& output : outputs)
+  {
+    if (!fs::is_regular_file(output, ec) || fs::hard_link_count(output, ec) < 2)
+      continue;
+
+    fs::path copy = output;
+    copy += ".detach";
+    if (fs::copy_file(output, copy, fs::copy_options::overwrite_existing, ec))
+      fs::rename(copy, output, ec);
+    if (ec)
+      fs::remove(copy, ec);
+  }
+}
+
+void ArtifactCache::EvictLocked()
+{
+  std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+  std::error_code ec;
+
+  for (const fs::directory_entry& shard : fs::directory_iterator(root_, ec))
+  {
+    if (!shard.is_directory(ec)) continue;
+    for (const fs::directory_entry& entry : fs::directory_iterator(shard.path(), ec))
+      if (entry.is_directory(ec) && entry.path().extension() != ".tmp")
+        entries.emplace_back(entry.last_write_time(ec), entry.path());
+  }
+
+  std::sort(entries.begin(), entries.end());
+
+  uint64_t total = DirectorySize(root_);
+  // evict down to 90% of the limit so the next stores don't rescan right away
+  uint64_t target = max_bytes_ / 10 * 9;
+  for (const auto& [time, path] : entries)
+  {
+    if (total <= target) break;
+    uint64_t size = DirectorySize(path);
+    fs::remove_all(path, ec);
+    if (ec) continue;
+    total -= std::min(total, size);
+    evictions_++;
+  }
+  total_bytes_ = total;
+}
+
+void ArtifactCache::PrintStats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  loging::LogInfo("Cache: " + std::to_string(hits_) + " hits, " + std::to_string(misses_) + " misses, " +
+                  std::to_string(stores_) + " stored, " + std::to_string(evictions_) + " evicted");
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Content-addressed store of recipe outputs. An entry is keyed on the
+// expanded recipe and the contents of all prerequisites, so an identical
+// build on another branch restores the outputs instead of running the recipe.
+class ArtifactCache
+{
+  std::filesystem::path root_;
+  uint64_t max_bytes_;
+  std::optional<uint64_t> total_bytes_;
+
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  size_t stores_ = 0;
+  size_t evictions_ = 0;
+
+  mutable std::mutex mutex_;
+
+  std::filesystem::path EntryPath(const std::string& key) const;
+  void EvictLocked();
+
+public:
+  ArtifactCache(std::filesystem::path root, uint64_t max_bytes);
+
+  // nullopt when some prerequisite can't be read, such entries are never cached
+  std::optional<std::string> ComputeKey(const std::vector<std::string>& commands,
+                                        const std::vector<std::filesystem::path>& inputs) const;
+
+  bool Restore(const std::string& key, const std::vector<std::filesystem::path>& outputs);
+  void Store(const std::string& key, const std::vector<std::filesystem::path>& outputs);
+
+  // Restore may hard link outputs to cache entries; a recipe that rewrites
+  // such a file in place would corrupt the entry, so it gets a private copy
+  // before the recipe runs.
+  void DetachOutputs(const std::vector<std::filesystem::path>& outputs);
+
+  void PrintStats() const;
+};
@@ -0,0 +1,39 @@
+@echo off
+
+rem Benchmarks link against make.lib, run ..\build.bat first.
+
+set CXX=clang++
+set CXXFLAGS=-std=c++23 -O2
+
+cd /d "%~dp0"
+
+if not exist ..\make.lib (
+    echo ..\make.lib not found, run build.bat in the repository root first
+    exit /b 1
+)
+
+echo Building benchmarks...
+rem macro_bench drives builds through fork and wait4 and is only built by build.sh
+%CXX% %CXXFLAGS% scan_kernels_bench.cpp ..\make.lib -o scan_kernels_bench.exe
+if errorlevel 1 (
+    echo Build failed!
+    exit /b 1
+)
+%CXX% %CXXFLAGS% word_kernels_bench.cpp ..\make.lib -o word_kernels_bench.exe
+if errorlevel 1 (
+    echo Build failed!
+    exit /b 1
+)
+%CXX% %CXXFLAGS% expand_bench.cpp ..\make.lib -o expand_bench.exe
+if errorlevel 1 (
+    echo Build failed!
+    exit /b 1
+)
+%CXX% %CXXFLAGS% scheduler_bench.cpp ..\make.lib -o scheduler_bench.exe
+
+if errorlevel 1 (
+    echo Build failed!
+    exit /b 1
+)
+
+echo Build completed successfully!
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Benchmarks link against libmake.a, run ../build.sh first.
+
+CXX="clang++"
+CXXFLAGS="-std=c++23 -O2"
+
+cd "$(dirname "$0")"
+
+if [ ! -f ../libmake.a ]; then
+    echo "../libmake.a not found, run build.sh in the repository root first"
+    exit 1
+fi
+
+echo Building benchmarks...
+$CXX $CXXFLAGS scan_kernels_bench.cpp ../libmake.a -o scan_kernels_bench
+$CXX $CXXFLAGS word_kernels_bench.cpp ../libmake.a -o word_kernels_bench
+$CXX $CXXFLAGS expand_bench.cpp ../libmake.a -o expand_bench
+$CXX $CXXFLAGS scheduler_bench.cpp ../libmake.a -o scheduler_bench
+$CXX $CXXFLAGS macro_bench.cpp -o macro_bench
+
+if [ $? -ne 0 ]; then
+    echo Build failed!
+    exit 1
+fi
+
+echo Build completed successfully!
@@ -0,0 +1,80 @@
+// Variable expansion over synthetic source lists of growing size. Every
+// case runs at 1x, 2x, 4x and 8x the base list; the time per output byte
+// has to stay flat for expansion to be linear.
+//
+//   ./expand_bench [files]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include "../expander.h"
+
+namespace
+{
+  // SRC refers to $(DIR) once per file, so expanding it resolves thousands
+  // of references into a list of a few megabytes
+  std::unordered_map<std::string, std::string> MakeVariables(size_t files)
+  {
+    std::unordered_map<std::string, std::string> vars;
+    vars["DIR"] = "src/components";
+    std::string& src = vars["SRC"];
+    for (size_t i = 0; i < files; ++i)
+      src += "$(DIR)/module_" + std::to_string(i) + "/source_file_" + std::to_string(i) + ".cpp ";
+    vars["OBJ"] = "$(SRC:.cpp=.o)";
+    return vars;
+  }
+
+  struct Case
+  {
+    const char* name;
+    const char* text;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  size_t files = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 25000;
+
+  const Case cases[] = {
+    {"reference", "$(SRC)"},
+    {"substitution", "$(OBJ)"},
+    {"patsubst", "$(patsubst src/%.cpp,obj/%.o,$(SRC))"},
+    {"foreach", "$(foreach f,$(SRC),-I$(dir $(f)))"},
+    {"nested", "$(addprefix build/,$(notdir $(basename $(SRC))))"},
+    {"concatenation", "$(SRC) $(OBJ) $(SRC) $(OBJ)"},
+  };
+
+  Expander expander;
+  for (const Case& test : cases)
+  {
+    double base_ns = 0;
+    for (size_t scale = 1; scale <= 8; scale *= 2)
+    {
+      std::unordered_map<std::string, std::string> vars = MakeVariables(files * scale);
+      MapScope scope(vars);
+
+      std::string out;
+      expander.ExpandInto(test.text, scope, out);
+      int runs = 0;
+      auto start = std::chrono::steady_clock::now();
+      std::chrono::duration<double> elapsed{};
+      do
+      {
+        out.clear();
+        expander.ExpandInto(test.text, scope, out);
+        runs++;
+        elapsed = std::chrono::steady_clock::now() - start;
+      } while (elapsed.count() < 0.2);
+
+      double ns = elapsed.count() * 1e9 / runs / out.size();
+      if (scale == 1)
+        base_ns = ns;
+      std::cout << test.name << "\t" << files * scale << " files\t" << (out.size() >> 10) << " KB\t"
+                << elapsed.count() * 1e3 / runs << " ms\t" << ns << " ns/byte\t" << ns / base_ns << "x\n";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,343 @@
+// End-to-end timings of whole builds on generated C++ trees, for this make
+// and for GNU make when one is installed. Recipes call this program back as
+// a stub compiler that only creates its -o file, so the numbers are the
+// make's own cost: reading the Makefile, checking files, spawning recipes.
+//
+//   ./macro_bench [--units 1000,10000,100000] [--make ../make] [--gnu-make PATH|none]
+//                 [--dir DIR] [-j N] [--no-strace]
+//
+// Every tree size is built with these scenarios, in this order:
+//   dry-run   -n from a clean tree
+//   cold      full build from a clean tree
+//   no-op     build again with nothing to do
+//   question  -q on the up to date tree
+//   touch     build after touching one widely included header
+// The results go to stdout as JSON: wall time, peak RSS of the make, the
+// number of recipe spawns and, when strace is on PATH, the syscall count of a
+// second run under strace -f -c. POSIX only.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  constexpr size_t kUnitsPerModule = 100;
+  constexpr size_t kIncludedModules = 3;
+  constexpr const char* kSpawnsVariable = "MACRO_BENCH_SPAWNS";
+
+  // macro_bench --stub [args] -o FILE: creates FILE and counts the spawn
+  int RunStub(int argc, char* argv[])
+  {
+    for (int i = 2; i + 1 < argc; ++i)
+    {
+      if (std::strcmp(argv[i], "-o") != 0) continue;
+      int fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) return 1;
+      close(fd);
+    }
+    if (const char* spawns = std::getenv(kSpawnsVariable))
+    {
+      int fd = open(spawns, O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd >= 0)
+      {
+        [[maybe_unused]] ssize_t written = write(fd, "x", 1);
+        close(fd);
+      }
+    }
+    return 0;
+  }
+
+  // N units in modules of 100. Each unit includes common.h, its module's
+  // header and three other module headers, as a generated .d file would list
+  // them; each module is archived, and the archives are linked into app.
+  void GenerateTree(const fs::path& dir, size_t units, const std::string& stub)
+  {
+    fs::remove_all(dir);
+    for (const char* sub : {"src", "include", "obj", "lib"})
+      fs::create_directories(dir / sub);
+
+    size_t modules = std::max<size_t>(1, (units + kUnitsPerModule - 1) / kUnitsPerModule);
+    std::ofstream(dir / "include/common.h") << "#pragma once\n";
+    for (size_t m = 0; m < modules; ++m)
+      std::ofstream(dir / ("include/mod_" + std::to_string(m) + ".h")) << "#pragma once\n";
+
+    std::mt19937 random(42);
+    std::ostringstream makefile;
+    makefile << "CC = " << stub << "\n\napp:";
+    for (size_t m = 0; m < modules; ++m)
+      makefile << " lib/mod_" << m << ".a";
+    makefile << "\n\t$(CC) -o $@ $^\n";
+
+    for (size_t m = 0; m < modules; ++m)
+    {
+      makefile << "\nlib/mod_" << m << ".a:";
+      for (size_t u = m * kUnitsPerModule; u < std::min(units, (m + 1) * kUnitsPerModule); ++u)
+        makefile << " obj/u" << u << ".o";
+      makefile << "\n\t$(CC) -o $@ $^\n";
+    }
+
+    for (size_t u = 0; u < units; ++u)
+    {
+      std::string name = "u" + std::to_string(u);
+      std::ofstream(dir / "src" / (name + ".cpp")) << "#include \"mod_" << u / kUnitsPerModule << ".h\"\n";
+
+      makefile << "\nobj/" << name << ".o: src/" << name << ".cpp include/common.h include/mod_" << u / kUnitsPerModule << ".h";
+      for (size_t i = 0; i < std::min(kIncludedModules, modules - 1); ++i)
+        makefile << " include/mod_" << random() % modules << ".h";
+      makefile << "\n\t$(CC) -c $< -o $@\n";
+    }
+    std::ofstream(dir / "Makefile") << makefile.str();
+  }
+
+  void CleanTree(const fs::path& dir)
+  {
+    for (const char* sub : {"obj", "lib"})
+    {
+      fs::remove_all(dir / sub);
+      fs::create_directory(dir / sub);
+    }
+    fs::remove(dir / "app");
+    fs::remove(dir / ".make_history");
+  }
+
+  struct Run
+  {
+    int status = -1;
+    double wall_seconds = 0;
+    long max_rss_kb = 0;
+  };
+
+  // runs argv in dir with its output thrown away
+  Run Spawn(const std::vector<std::string>& argv, const fs::path& dir, const fs::path& spawns)
+  {
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      if (chdir(dir.c_str()) != 0) _exit(127);
+      setenv(kSpawnsVariable, spawns.c_str(), 1);
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+
+      std::vector<char*> args;
+      for (const std::string& arg : argv)
+        args.push_back(const_cast<char*>(arg.c_str()));
+      args.push_back(nullptr);
+      execvp(args[0], args.data());
+      _exit(127);
+    }
+
+    Run run;
+    int status = 0;
+    rusage usage{};
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid)
+    {
+      run.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+      run.max_rss_kb = usage.ru_maxrss;
+    }
+    run.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return run;
+  }
+
+  std::optional<fs::path> FindInPath(const std::string& name)
+  {
+    if (name.find('/') != std::string::npos)
+      return fs::exists(name) ? std::optional<fs::path>(fs::absolute(name)) : std::nullopt;
+    const char* path = std::getenv("PATH");
+    std::istringstream dirs(path ? path : "");
+    for (std::string dir; std::getline(dirs, dir, ':');)
+    {
+      fs::path candidate = fs::path(dir.empty() ? "." : dir) / name;
+      if (access(candidate.c_str(), X_OK) == 0)
+        return fs::absolute(candidate);
+    }
+    return std::nullopt;
+  }
+
+  bool IsGnuMake(const fs::path& make)
+  {
+    FILE* pipe = popen(("'" + make.string() + "' --version 2>/dev/null").c_str(), "r");
+    if (!pipe) return false;
+    char line[256] = {};
+    bool gnu = std::fgets(line, sizeof(line), pipe) && std::strstr(line, "GNU Make");
+    pclose(pipe);
+    return gnu;
+  }
+
+  // the calls column of the total line of strace -c
+  std::optional<long> ReadSyscallTotal(const fs::path& summary)
+  {
+    std::ifstream in(summary);
+    for (std::string line; std::getline(in, line);)
+    {
+      std::istringstream words(line);
+      std::vector<std::string> columns;
+      for (std::string word; words >> word;)
+        columns.push_back(word);
+      if (columns.size() >= 5 && columns.back() == "total")
+        return std::strtol(columns[3].c_str(), nullptr, 10);
+    }
+    return std::nullopt;
+  }
+
+  struct Scenario
+  {
+    const char* name;
+    const char* flag;
+    // puts the tree into the state the scenario starts from
+    void (*prepare)(const fs::path& dir);
+  };
+
+  // stamped by the kernel like the recipe outputs that follow, which a
+  // precise clock::now() could be newer than
+  void Touch(const fs::path& dir)
+  {
+    utimensat(AT_FDCWD, (dir / "include/mod_0.h").c_str(), nullptr, 0);
+  }
+
+  const Scenario kScenarios[] = {
+    {"dry-run", "-n", CleanTree},
+    {"cold", nullptr, CleanTree},
+    {"no-op", nullptr, nullptr},
+    {"question", "-q", nullptr},
+    {"touch", nullptr, Touch},
+  };
+
+  struct Tool
+  {
+    std::string name;
+    fs::path path;
+  };
+
+  std::vector<size_t> ParseUnits(const std::string& list)
+  {
+    std::vector<size_t> units;
+    std::istringstream items(list);
+    for (std::string item; std::getline(items, item, ',');)
+      if (size_t n = std::strtoul(item.c_str(), nullptr, 10))
+        units.push_back(n);
+    return units;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc > 1 && std::strcmp(argv[1], "--stub") == 0)
+    return RunStub(argc, argv);
+
+  std::vector<size_t> units = {1000, 10000, 100000};
+  std::string make = "../make";
+  std::string gnu_make = "make";
+  fs::path root = fs::temp_directory_path() / "macro_bench";
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+  bool use_strace = true;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--units" && has_value) units = ParseUnits(argv[++i]);
+    else if (arg == "--make" && has_value) make = argv[++i];
+    else if (arg == "--gnu-make" && has_value) gnu_make = argv[++i];
+    else if (arg == "--dir" && has_value) root = argv[++i];
+    else if (arg == "-j" && has_value) jobs = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    else if (arg == "--no-strace") use_strace = false;
+    else
+    {
+      std::cerr << "unknown argument '" << arg << "'\n";
+      return 2;
+    }
+  }
+
+  std::vector<Tool> tools;
+  std::optional<fs::path> own = FindInPath(make);
+  if (!own)
+  {
+    std::cerr << make << " not found, run build.sh in the repository root first\n";
+    return 1;
+  }
+  tools.push_back({"make", *own});
+  if (gnu_make != "none")
+  {
+    std::optional<fs::path> gnu = FindInPath(gnu_make);
+    std::error_code ec;
+    if (gnu && !fs::equivalent(*gnu, *own, ec) && IsGnuMake(*gnu))
+      tools.push_back({"gnu-make", *gnu});
+    else
+      std::cerr << "GNU make not found, timing only " << *own << "\n";
+  }
+
+  std::optional<fs::path> strace = use_strace ? FindInPath("strace") : std::nullopt;
+  std::string stub = fs::canonical("/proc/self/exe").string() + " --stub";
+
+  std::ostringstream json;
+  json << "{\n  \"jobs\": " << jobs << ",\n  \"strace\": " << (strace ? "true" : "false") << ",\n  \"results\": [";
+  bool first = true;
+  for (size_t n : units)
+  {
+    fs::path dir = fs::absolute(root / ("units_" + std::to_string(n)));
+    std::cerr << "generating " << n << " units in " << dir << "\n";
+    GenerateTree(dir, n, stub);
+    fs::path spawns = dir / "spawns.log";
+
+    for (const Tool& tool : tools)
+    {
+      for (const Scenario& scenario : kScenarios)
+      {
+        std::vector<std::string> command = {tool.path.string(), "-f", "Makefile", "-j", std::to_string(jobs)};
+        if (scenario.flag)
+          command.push_back(scenario.flag);
+        command.push_back("app");
+
+        if (scenario.prepare) scenario.prepare(dir);
+        fs::remove(spawns);
+        Run run = Spawn(command, dir, spawns);
+        std::error_code ec;
+        uintmax_t spawned = fs::file_size(spawns, ec);
+        if (ec) spawned = 0;
+
+        // strace slows the make down, so syscalls come from a second run
+        std::optional<long> syscalls;
+        if (strace)
+        {
+          if (scenario.prepare) scenario.prepare(dir);
+          fs::path summary = dir / "strace.txt";
+          std::vector<std::string> traced = {strace->string(), "-f", "-c", "-o", summary.string()};
+          traced.insert(traced.end(), command.begin(), command.end());
+          Spawn(traced, dir, dir / "strace_spawns.log");
+          syscalls = ReadSyscallTotal(summary);
+        }
+
+        std::cerr << tool.name << "\t" << n << "\t" << scenario.name << "\t" << run.wall_seconds << " s\n";
+        json << (first ? "\n" : ",\n") << "    {\"make\": \"" << tool.name << "\", \"units\": " << n
+             << ", \"scenario\": \"" << scenario.name << "\", \"exit\": " << run.status
+             << ", \"wall_seconds\": " << run.wall_seconds << ", \"max_rss_kb\": " << run.max_rss_kb
+             << ", \"spawns\": " << spawned << ", \"syscalls\": " << (syscalls ? std::to_string(*syscalls) : "null") << "}";
+        first = false;
+      }
+    }
+  }
+  json << "\n  ]\n}\n";
+  std::cout << json.str();
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Throughput of every scan kernel this CPU can run, on Makefile-like text.
+// Each kernel also has to find exactly the positions the scalar one finds.
+//
+//   ./scan_kernels_bench [megabytes]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../scan_kernels.h"
+
+namespace
+{
+  std::string MakeText(size_t bytes)
+  {
+    std::mt19937 random(42);
+    std::string text;
+    text.reserve(bytes + 128);
+    for (size_t i = 0; text.size() < bytes; ++i)
+    {
+      std::string name = "src/module_" + std::to_string(random() % 100000);
+      switch (i % 4)
+      {
+        case 0: text += name + ".o: " + name + ".cpp " + name + ".h include/common.h\n"; break;
+        case 1: text += "\t$(CXX) $(CXXFLAGS) -c $< -o $@\n"; break;
+        case 2: text += "SOURCES += " + name + ".cpp " + name + "_test.cpp\n"; break;
+        default: text += "# generated from " + name + ".json\n"; break;
+      }
+    }
+    return text;
+  }
+
+  struct Set
+  {
+    const char* name;
+    ScanSet set;
+  };
+
+  std::vector<size_t> FindAll(std::string_view text, ScanSet set)
+  {
+    std::vector<size_t> hits;
+    for (size_t pos = ScanFind(text, set); pos != std::string_view::npos; pos = ScanFind(text, set, pos + 1))
+      hits.push_back(pos);
+    return hits;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+  std::string text = MakeText(megabytes << 20);
+
+  const Set sets[] = {
+    {"$", kScanDollar},
+    {": =", kScanColon | kScanEquals},
+    {"all", 0xff},
+    {"rare \\|", kScanBackslash | kScanBar},
+  };
+
+  std::cout << "default kernel: " << ScanKernelName() << ", " << (text.size() >> 20) << " MB of text\n";
+  int failures = 0;
+  for (const Set& set : sets)
+  {
+    SelectScanKernel("scalar");
+    std::vector<size_t> expected = FindAll(text, set.set);
+
+    for (const char* kernel : AvailableScanKernels())
+    {
+      SelectScanKernel(kernel);
+      auto start = std::chrono::steady_clock::now();
+      std::vector<size_t> hits = FindAll(text, set.set);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      bool same = hits == expected;
+      failures += !same;
+      std::cout << "set " << set.name << "\t" << kernel << "\t" << static_cast<int>(text.size() / seconds / (1 << 20))
+                << " MB/s\t" << hits.size() << " hits" << (same ? "" : "\tMISMATCH") << "\n";
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
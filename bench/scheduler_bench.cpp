@@ -0,0 +1,170 @@
+// The scheduler's critical-path order against starting ready nodes in the
+// order they became ready, on a synthetic project: modules of objects
+// archived into libraries, and one slow object behind a long link, the case
+// a first-come order starts last. Recipes are simulated in virtual time, so
+// the makespans are exact and the same on every run.
+//
+//   ./scheduler_bench [modules]
+//
+// Each job count prints the makespans of both orders, of the critical-path
+// order without a build history (which falls back to fan-out), and the lower
+// bound of the graph: the longer of its critical path and its total work
+// spread over the jobs.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../build_graph.h"
+#include "../rule.h"
+#include "../scheduler.h"
+
+namespace
+{
+  constexpr size_t kObjectsPerModule = 40;
+
+  struct Project
+  {
+    BuildGraph graph;
+    std::deque<Rule> rules;
+    std::vector<uint64_t> durations_ms;
+    uint64_t work_ms = 0;
+    // whether the graph gets the recipe times, as from an earlier build
+    bool history = true;
+
+    BuildGraph::NodeId Add(const std::string& name, std::vector<BuildGraph::NodeId> prerequisites, uint64_t ms)
+    {
+      BuildGraph::NodeId id = graph.AddTarget(name, rules.emplace_back(), prerequisites, {}, history ? ms : 0);
+      durations_ms.resize(id + 1);
+      durations_ms[id] = ms;
+      work_ms += ms;
+      return id;
+    }
+  };
+
+  // objects take 1-10 s, archives 2 s, the app links in 20 s; the tool
+  // behind the generated sources is one 60 s object and a 240 s link,
+  // added last as a Makefile would list it
+  void MakeProject(Project& project, size_t modules, bool history)
+  {
+    project.history = history;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<uint64_t> object_ms(1000, 10000);
+
+    std::vector<BuildGraph::NodeId> libraries;
+    for (size_t module = 0; module < modules; ++module)
+    {
+      std::vector<BuildGraph::NodeId> objects;
+      for (size_t i = 0; i < kObjectsPerModule; ++i)
+        objects.push_back(project.Add("obj/" + std::to_string(module) + "/" + std::to_string(i) + ".o", {},
+                                      object_ms(random)));
+      libraries.push_back(project.Add("lib/" + std::to_string(module) + ".a", objects, 2000));
+    }
+
+    BuildGraph::NodeId slow = project.Add("obj/generator.o", {}, 60000);
+    libraries.push_back(project.Add("bin/generator", {slow}, 240000));
+    project.Add("app", libraries, 20000);
+    project.graph.Finalize();
+  }
+
+  // Jobs finish in virtual time. The scheduler starts jobs from its own
+  // thread until no node is ready or no slot is free, and only then waits,
+  // so a job is completed as soon as nothing else could start before it.
+  class Simulation
+  {
+    struct Running
+    {
+      uint64_t end_ms;
+      BuildGraph::NodeId id;
+      BuildScheduler::Completion complete;
+      bool operator>(const Running& other) const {return end_ms > other.end_ms;}
+    };
+
+    const Project& project_;
+    size_t jobs_;
+    uint64_t now_ms_ = 0;
+    std::priority_queue<Running, std::vector<Running>, std::greater<>> running_;
+    std::vector<bool> started_;
+    std::vector<bool> done_;
+
+    bool AnyReady() const
+    {
+      const BuildGraph& graph = project_.graph;
+      for (BuildGraph::NodeId id = 0; id < graph.Size(); ++id)
+      {
+        if (started_[id]) continue;
+        std::span<const BuildGraph::NodeId> prerequisites = graph.GetPrerequisites(id);
+        if (std::all_of(prerequisites.begin(), prerequisites.end(), [this](BuildGraph::NodeId p) {return done_[p];}))
+          return true;
+      }
+      return false;
+    }
+
+  public:
+    Simulation(const Project& project, size_t jobs)
+      : project_(project), jobs_(jobs), started_(project.graph.Size()), done_(project.graph.Size())
+    {}
+
+    void Start(BuildGraph::NodeId id, BuildScheduler::Completion complete)
+    {
+      started_[id] = true;
+      running_.push({now_ms_ + project_.durations_ms[id], id, std::move(complete)});
+
+      while (!running_.empty() && (running_.size() == jobs_ || !AnyReady()))
+      {
+        now_ms_ = running_.top().end_ms;
+        while (!running_.empty() && running_.top().end_ms == now_ms_)
+        {
+          Running finished = running_.top();
+          running_.pop();
+          done_[finished.id] = true;
+          finished.complete(true, nullptr);
+        }
+      }
+    }
+
+    uint64_t Makespan() const {return now_ms_;}
+  };
+
+  uint64_t Run(const Project& project, size_t jobs, BuildScheduler::Order order)
+  {
+    Simulation simulation(project, jobs);
+    BuildScheduler(order).Run(project.graph, [&simulation](BuildGraph::NodeId id, BuildScheduler::Completion complete) {
+      simulation.Start(id, std::move(complete));
+    }, jobs, false);
+    return simulation.Makespan();
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  size_t modules = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50;
+
+  Project project;
+  MakeProject(project, modules, true);
+  Project first_build;
+  MakeProject(first_build, modules, false);
+  uint64_t critical_path_ms = 0;
+  for (BuildGraph::NodeId id = 0; id < project.graph.Size(); ++id)
+    critical_path_ms = std::max(critical_path_ms, project.graph.GetCriticalPath(id));
+
+  std::cout << project.graph.Size() << " recipes, " << project.work_ms / 1000 << " s of work, critical path "
+            << critical_path_ms / 1000 << " s\n";
+  std::cout << "jobs\tready-first\tno history\tcritical-path\tbound\tspeedup\n";
+  for (size_t jobs : {4, 8, 16, 32, 64})
+  {
+    uint64_t fifo_ms = Run(project, jobs, BuildScheduler::Order::kReadyFirst);
+    uint64_t fan_out_ms = Run(first_build, jobs, BuildScheduler::Order::kCriticalPath);
+    uint64_t critical_ms = Run(project, jobs, BuildScheduler::Order::kCriticalPath);
+    uint64_t bound_ms = std::max(critical_path_ms, (project.work_ms + jobs - 1) / jobs);
+    std::cout << jobs << "\t" << fifo_ms / 1000.0 << " s\t" << fan_out_ms / 1000.0 << " s\t" << critical_ms / 1000.0 << " s\t"
+              << bound_ms / 1000.0 << " s\t" << static_cast<double>(fifo_ms) / critical_ms << "x\n";
+  }
+}
@@ -0,0 +1,120 @@
+// The word-list kernels on synthetic file lists of growing size. Every
+// kernel runs at 1x, 2x, 4x and 8x the base list; the time per word has to
+// stay flat for it to be linear. Splitting also runs with each whitespace
+// kernel this CPU has and has to find the words the scalar one finds.
+//
+//   ./word_kernels_bench [words]
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../scan_kernels.h"
+#include "../word_kernels.h"
+
+namespace
+{
+  // shuffled names with duplicates, separated by the whitespace Makefiles use
+  std::string MakeList(size_t words)
+  {
+    std::mt19937 random(42);
+    const char separators[] = {' ', ' ', ' ', '\t', '\n'};
+    std::string text;
+    for (size_t i = 0; i < words; ++i)
+    {
+      size_t module = random() % (words / 2 + 1);
+      text += "src/module_" + std::to_string(module % 100) + "/file_" + std::to_string(module);
+      text += i % 3 == 0 ? ".cpp" : ".h";
+      text += separators[random() % std::size(separators)];
+    }
+    return text;
+  }
+
+  // seconds per call, running it for at least 0.2 s
+  double Time(const std::function<void()>& run)
+  {
+    int runs = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{};
+    do
+    {
+      run();
+      runs++;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 0.2);
+    return elapsed.count() / runs;
+  }
+
+  struct Kernel
+  {
+    const char* name;
+    std::function<void(const std::string& text, std::vector<std::string_view>& words, std::string& out)> run;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  size_t base = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+  const std::vector<std::string_view> patterns = {"%.h", "src/module_7/%", "src/module_1/file_1.cpp"};
+  const Kernel kernels[] = {
+    {"split", [](const std::string& text, std::vector<std::string_view>& words, std::string&) {
+      words.clear();
+      SplitWords(text, words);
+    }},
+    {"sort", [](const std::string&, std::vector<std::string_view>& words, std::string&) {
+      std::vector<std::string_view> copy = words;
+      SortUniqueWords(copy);
+    }},
+    {"filter", [&patterns](const std::string&, std::vector<std::string_view>& words, std::string& out) {
+      out.clear();
+      FilterWords(patterns, words, true, out);
+    }},
+    {"patsubst", [](const std::string&, std::vector<std::string_view>& words, std::string& out) {
+      out.clear();
+      PatsubstWords("src/%.cpp", "obj/%.o", words, out);
+    }},
+  };
+
+  std::cout << "default kernel: " << ScanKernelName() << "\n";
+  for (const Kernel& kernel : kernels)
+  {
+    double base_ns = 0;
+    for (size_t scale = 1; scale <= 8; scale *= 2)
+    {
+      std::string text = MakeList(base * scale);
+      std::vector<std::string_view> words = SplitWords(text);
+      std::string out;
+
+      double ns = Time([&]() { kernel.run(text, words, out); }) * 1e9 / words.size();
+      if (scale == 1)
+        base_ns = ns;
+      std::cout << kernel.name << "\t" << words.size() << " words\t" << ns << " ns/word\t" << ns / base_ns << "x\n";
+    }
+  }
+
+  int failures = 0;
+  std::string text = MakeList(base * 8);
+  SelectScanKernel("scalar");
+  std::vector<std::string_view> expected = SplitWords(text);
+  for (const char* name : AvailableScanKernels())
+  {
+    SelectScanKernel(name);
+    std::vector<std::string_view> words;
+    double seconds = Time([&]() {
+      words.clear();
+      SplitWords(text, words);
+    });
+
+    bool same = words == expected;
+    failures += !same;
+    std::cout << "split\t" << name << "\t" << static_cast<int>(text.size() / seconds / (1 << 20)) << " MB/s"
+              << (same ? "" : "\tMISMATCH") << "\n";
+  }
+  return failures == 0 ? 0 : 1;
+}
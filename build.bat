@@ -1,6 +1,7 @@
 @echo off
 set CXXFLAGS=-std=c++23 -O2
 set CXX=clang++
+set AR=llvm-ar
 
 echo Cleaning old object files...
 del /Q *.o 2>nul
@@ -11,6 +12,29 @@ echo Compiling object files...
 %CXX% %CXXFLAGS% -c makefile.cpp -o makefile.o
 %CXX% %CXXFLAGS% -c parser.cpp -o parser.o
 %CXX% %CXXFLAGS% -c rule.cpp -o rule.o
+%CXX% %CXXFLAGS% -c scheduler.cpp -o scheduler.o
+%CXX% %CXXFLAGS% -c build_history.cpp -o build_history.o
+%CXX% %CXXFLAGS% -c executor.cpp -o executor.o
+%CXX% %CXXFLAGS% -c remote_executor.cpp -o remote_executor.o
+%CXX% %CXXFLAGS% -c worker.cpp -o worker.o
+%CXX% %CXXFLAGS% -c wire_protocol.cpp -o wire_protocol.o
+%CXX% %CXXFLAGS% -c artifact_cache.cpp -o artifact_cache.o
+%CXX% %CXXFLAGS% -c sha256.cpp -o sha256.o
+%CXX% %CXXFLAGS% -c expression.cpp -o expression.o
+%CXX% %CXXFLAGS% -c expander.cpp -o expander.o
+%CXX% %CXXFLAGS% -c functions.cpp -o functions.o
+%CXX% %CXXFLAGS% -c dir_cache.cpp -o dir_cache.o
+%CXX% %CXXFLAGS% -c word_kernels.cpp -o word_kernels.o
+%CXX% %CXXFLAGS% -c vpath.cpp -o vpath.o
+%CXX% %CXXFLAGS% -c target_vars.cpp -o target_vars.o
+%CXX% %CXXFLAGS% -c variables.cpp -o variables.o
+%CXX% %CXXFLAGS% -c process_supervisor.cpp -o process_supervisor.o
+%CXX% %CXXFLAGS% -c ninja_writer.cpp -o ninja_writer.o
+%CXX% %CXXFLAGS% -c build_session.cpp -o build_session.o
+%CXX% %CXXFLAGS% -c scan_kernels.cpp -o scan_kernels.o
+%CXX% %CXXFLAGS% -c lexer.cpp -o lexer.o
+%CXX% %CXXFLAGS% -c build_graph.cpp -o build_graph.o
+%CXX% %CXXFLAGS% -c pattern_rule.cpp -o pattern_rule.o
 %CXX% %CXXFLAGS% -c argparser\argparser.cpp -o argparser\argparser.o
 %CXX% %CXXFLAGS% -c argparser\argument.cpp -o argparser\argument.o
 
@@ -19,8 +43,16 @@ if errorlevel 1 (
     exit /b 1
 )
 
+echo Archiving library...
+%AR% rcs make.lib makefile.o parser.o rule.o scheduler.o build_history.o executor.o remote_executor.o worker.o wire_protocol.o artifact_cache.o sha256.o expression.o expander.o functions.o dir_cache.o word_kernels.o vpath.o target_vars.o variables.o process_supervisor.o ninja_writer.o build_session.o scan_kernels.o lexer.o build_graph.o pattern_rule.o
+
+if errorlevel 1 (
+    echo Archiving failed!
+    exit /b 1
+)
+
 echo Linking...
-%CXX% main.o cli.o makefile.o parser.o rule.o argparser\argparser.o argparser\argument.o -o make.exe
+%CXX% main.o cli.o argparser\argparser.o argparser\argument.o make.lib -o make.exe
 
 if errorlevel 1 (
     echo Linking failed!
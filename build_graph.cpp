@@ -0,0 +1,181 @@
+#include "build_graph.h"
+
+#include <algorithm>
+
+#include "dir_cache.h"
+#include "rule.h"
+
+BuildGraph::NodeId BuildGraph::AddNode(const std::string& name, Rule* rule, uint8_t flags, uint64_t duration_ms)
+{
+  NodeId id = static_cast<NodeId>(flags_.size());
+  flags_.push_back(flags);
+  mtimes_.emplace_back();
+  durations_ms_.push_back(duration_ms);
+  pools_.push_back(0);
+  rules_.push_back(rule);
+  ids_.emplace(names_.emplace_back(name), id);
+  return id;
+}
+
+BuildGraph::NodeId BuildGraph::AddFile(const std::string& name)
+{
+  auto it = ids_.find(name);
+  if (it != ids_.end())
+    return it->second;
+
+  NodeId id = AddNode(name, nullptr, 0, 0);
+  order_only_offsets_.push_back(prerequisites_.size());
+  prerequisite_offsets_.push_back(prerequisites_.size());
+  return id;
+}
+
+void BuildGraph::AddAlias(const std::string& name, NodeId id)
+{
+  if (!ids_.contains(name))
+    ids_.emplace(alias_names_.emplace_back(name), id);
+}
+
+BuildGraph::NodeId BuildGraph::AddTarget(const std::string& name, Rule& rule, std::span<const NodeId> prerequisites,
+                                         std::span<const NodeId> order_only, uint64_t duration_ms)
+{
+  uint8_t flags = kHasRule | (rule.IsPhony() ? kPhony : 0);
+  NodeId id = AddNode(name, &rule, flags, duration_ms);
+  prerequisites_.insert(prerequisites_.end(), prerequisites.begin(), prerequisites.end());
+  order_only_offsets_.push_back(prerequisites_.size());
+  prerequisites_.insert(prerequisites_.end(), order_only.begin(), order_only.end());
+  prerequisite_offsets_.push_back(prerequisites_.size());
+  return id;
+}
+
+uint16_t BuildGraph::AddPool(size_t depth)
+{
+  pool_depths_.push_back(depth);
+  return static_cast<uint16_t>(pool_depths_.size() - 1);
+}
+
+void BuildGraph::AddBarrier(std::span<const NodeId> before, std::span<const NodeId> after)
+{
+  barrier_nodes_.insert(barrier_nodes_.end(), before.begin(), before.end());
+  barrier_offsets_.push_back(barrier_nodes_.size());
+  barrier_nodes_.insert(barrier_nodes_.end(), after.begin(), after.end());
+  barrier_offsets_.push_back(barrier_nodes_.size());
+}
+
+std::span<const BuildGraph::NodeId> BuildGraph::GetBarrierBefore(size_t barrier) const
+{
+  return std::span<const NodeId>(barrier_nodes_).subspan(barrier_offsets_[2 * barrier], barrier_offsets_[2 * barrier + 1] - barrier_offsets_[2 * barrier]);
+}
+
+std::span<const BuildGraph::NodeId> BuildGraph::GetBarrierAfter(size_t barrier) const
+{
+  return std::span<const NodeId>(barrier_nodes_).subspan(barrier_offsets_[2 * barrier + 1], barrier_offsets_[2 * barrier + 2] - barrier_offsets_[2 * barrier + 1]);
+}
+
+void BuildGraph::Finalize()
+{
+  size_t size = Size();
+
+  // count, prefix sum, scatter: dependents of a node end up in id order
+  dependent_offsets_.assign(size + 1, 0);
+  for (NodeId prerequisite : prerequisites_)
+    dependent_offsets_[prerequisite + 1]++;
+  for (size_t i = 0; i < size; ++i)
+    dependent_offsets_[i + 1] += dependent_offsets_[i];
+
+  dependents_.resize(prerequisites_.size());
+  dependent_normal_.resize(prerequisites_.size());
+  std::vector<size_t> next(dependent_offsets_.begin(), dependent_offsets_.end() - 1);
+  for (NodeId id = 0; id < size; ++id)
+  {
+    for (size_t edge = prerequisite_offsets_[id]; edge < prerequisite_offsets_[id + 1]; ++edge)
+    {
+      size_t slot = next[prerequisites_[edge]]++;
+      dependents_[slot] = id;
+      dependent_normal_[slot] = edge < order_only_offsets_[id];
+    }
+  }
+
+  // walking backwards visits every dependent before the nodes it waits on
+  critical_paths_ms_.assign(size, 0);
+  for (size_t i = size; i-- > 0;)
+  {
+    uint64_t longest_tail = 0;
+    for (NodeId dependent : GetDependents(static_cast<NodeId>(i)))
+      longest_tail = std::max(longest_tail, critical_paths_ms_[dependent]);
+    critical_paths_ms_[i] = durations_ms_[i] + longest_tail;
+  }
+}
+
+std::optional<BuildGraph::NodeId> BuildGraph::Find(const std::string& name) const
+{
+  auto it = ids_.find(name);
+  if (it == ids_.end()) return std::nullopt;
+  return it->second;
+}
+
+std::span<const BuildGraph::NodeId> BuildGraph::GetPrerequisites(NodeId id) const
+{
+  return std::span<const NodeId>(prerequisites_).subspan(prerequisite_offsets_[id], order_only_offsets_[id] - prerequisite_offsets_[id]);
+}
+
+std::span<const BuildGraph::NodeId> BuildGraph::GetOrderOnly(NodeId id) const
+{
+  return std::span<const NodeId>(prerequisites_).subspan(order_only_offsets_[id], prerequisite_offsets_[id + 1] - order_only_offsets_[id]);
+}
+
+std::span<const BuildGraph::NodeId> BuildGraph::GetDependents(NodeId id) const
+{
+  return std::span<const NodeId>(dependents_).subspan(dependent_offsets_[id], dependent_offsets_[id + 1] - dependent_offsets_[id]);
+}
+
+bool BuildGraph::Exists(NodeId id, DirectoryCache& dirs)
+{
+  if (!HasFlag(id, kStatted))
+  {
+    // a target is looked for where VPATH search put it; a group exists when
+    // all of its members do
+    std::vector<fs::path> paths = rules_[id] ? rules_[id]->GetOutputs() : std::vector<fs::path>{names_[id]};
+    flags_[id] |= kExists;
+    fs::file_time_type oldest;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      std::error_code error;
+      fs::file_time_type mtime;
+      bool exists = dirs.Exists(paths[i].string());
+      if (exists)
+        mtime = fs::last_write_time(dirs.Resolve(paths[i].string()), error);
+      if (!exists || error)
+      {
+        flags_[id] &= ~kExists;
+        break;
+      }
+      if (i == 0 || mtime > mtimes_[id])
+        mtimes_[id] = mtime;
+      if (i == 0 || mtime < oldest)
+        oldest = mtime;
+    }
+    if (paths.size() > 1)
+      group_oldest_[id] = oldest;
+    flags_[id] |= kStatted;
+  }
+  return HasFlag(id, kExists);
+}
+
+void BuildGraph::Reset()
+{
+  for (uint8_t& flags : flags_)
+    flags &= ~(kDirty | kStatted);
+}
+
+fs::file_time_type BuildGraph::GetMtime(NodeId id, DirectoryCache& dirs)
+{
+  Exists(id, dirs);
+  return mtimes_[id];
+}
+
+fs::file_time_type BuildGraph::GetOldestMtime(NodeId id, DirectoryCache& dirs)
+{
+  Exists(id, dirs);
+  auto it = group_oldest_.find(id);
+  return it == group_oldest_.end() ? mtimes_[id] : it->second;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class DirectoryCache;
+class Rule;
+
+// The resolved dependency graph of one build in compressed sparse row form.
+// Every target to be made and every plain file one of them reads is a node.
+// Ids are handed out prerequisites first, so they are in topological order
+// and a walk is a loop over an index range. What such a walk looks at (flags,
+// mtime, critical path) is kept in arrays indexed by id; names and rules
+// live apart and are only read to run a recipe or print a message.
+class BuildGraph
+{
+public:
+  using NodeId = uint32_t;
+
+  enum Flag : uint8_t
+  {
+    kHasRule = 1 << 0,
+    kPhony = 1 << 1,
+    kDirty = 1 << 2,    // remade in this build, or listed in --changed-files
+    kStatted = 1 << 3,  // kExists and the mtime are current
+    kExists = 1 << 4,
+  };
+
+private:
+  // hot, one entry per node
+  std::vector<uint8_t> flags_;
+  std::vector<fs::file_time_type> mtimes_;
+  std::vector<uint64_t> durations_ms_;
+  std::vector<uint64_t> critical_paths_ms_;
+  std::vector<uint16_t> pools_;  // 0 for none
+
+  std::vector<size_t> pool_depths_ = {0};
+  // .WAIT barriers: the nodes before barrier b are barrier_nodes_ from
+  // barrier_offsets_[2b], the nodes held back until they are done follow
+  // from barrier_offsets_[2b + 1]
+  std::vector<size_t> barrier_offsets_ = {0};
+  std::vector<NodeId> barrier_nodes_;
+
+  // prerequisites of node i: normal ones from prerequisite_offsets_[i] to
+  // order_only_offsets_[i], order-only ones from there to the next offset
+  std::vector<size_t> prerequisite_offsets_ = {0};
+  std::vector<size_t> order_only_offsets_;
+  std::vector<NodeId> prerequisites_;
+
+  // reverse edges, filled in by Finalize, with a flag for the normal ones
+  std::vector<size_t> dependent_offsets_;
+  std::vector<NodeId> dependents_;
+  std::vector<uint8_t> dependent_normal_;
+
+  // cold; a deque never moves its strings, so ids_ keys point into them
+  std::deque<std::string> names_;
+  std::deque<std::string> alias_names_;
+  std::vector<Rule*> rules_;
+  std::unordered_map<std::string_view, NodeId> ids_;
+  // the oldest member of each grouped target
+  std::unordered_map<NodeId, fs::file_time_type> group_oldest_;
+
+  NodeId AddNode(const std::string& name, Rule* rule, uint8_t flags, uint64_t duration_ms);
+
+public:
+  // a file read by targets without being made; added once per name
+  NodeId AddFile(const std::string& name);
+  // a target, after all of its prerequisites
+  NodeId AddTarget(const std::string& name, Rule& rule, std::span<const NodeId> prerequisites,
+                   std::span<const NodeId> order_only, uint64_t duration_ms);
+  // another name for a node, for the other members of a grouped target
+  void AddAlias(const std::string& name, NodeId id);
+  // reverse edges and critical paths, once the last node is added
+  void Finalize();
+
+  size_t Size() const {return flags_.size();}
+  std::optional<NodeId> Find(const std::string& name) const;
+
+  const std::string& GetName(NodeId id) const {return names_[id];}
+  Rule* GetRule(NodeId id) const {return rules_[id];}
+
+  bool HasFlag(NodeId id, Flag flag) const {return (flags_[id] & flag) != 0;}
+  void SetFlag(NodeId id, Flag flag) {flags_[id] |= flag;}
+  void ClearFlag(NodeId id, Flag flag) {flags_[id] &= ~flag;}
+
+  std::span<const NodeId> GetPrerequisites(NodeId id) const;
+  std::span<const NodeId> GetOrderOnly(NodeId id) const;
+  std::span<const NodeId> GetDependents(NodeId id) const;
+  bool IsNormalDependent(NodeId id, size_t index) const {return dependent_normal_[dependent_offsets_[id] + index] != 0;}
+
+  // A resource pool lets at most depth of its nodes run at once.
+  uint16_t AddPool(size_t depth);
+  size_t GetPoolCount() const {return pool_depths_.size();}
+  size_t GetPoolDepth(uint16_t pool) const {return pool_depths_[pool];}
+  uint16_t GetPool(NodeId id) const {return pools_[id];}
+  void SetPool(NodeId id, uint16_t pool) {pools_[id] = pool;}
+
+  // The after nodes don't start before all before nodes are done, without
+  // an edge between them.
+  void AddBarrier(std::span<const NodeId> before, std::span<const NodeId> after);
+  size_t GetBarrierCount() const {return barrier_offsets_.size() / 2;}
+  std::span<const NodeId> GetBarrierBefore(size_t barrier) const;
+  std::span<const NodeId> GetBarrierAfter(size_t barrier) const;
+
+  // the longest sum of recipe times from the node to the goals
+  uint64_t GetCriticalPath(NodeId id) const {return critical_paths_ms_[id];}
+
+  // Each file is stat'ed once per build and again after its recipe ran.
+  // A grouped target has two times: dependents compare against its newest
+  // member, the group itself is as old as its oldest one.
+  bool Exists(NodeId id, DirectoryCache& dirs);
+  fs::file_time_type GetMtime(NodeId id, DirectoryCache& dirs);
+  fs::file_time_type GetOldestMtime(NodeId id, DirectoryCache& dirs);
+  void Invalidate(NodeId id) {flags_[id] &= ~kStatted;}
+  // forgets what a build found out, for the graph to be built again
+  void Reset();
+};
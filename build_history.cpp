@@ -0,0 +1,59 @@
+#include "build_history.h"
+
+#include <fstream>
+#include <string>
+#include <utility>
+
+BuildHistory::BuildHistory(std::string filename)
+  : filename_(std::move(filename))
+{}
+
+void BuildHistory::Load()
+{
+  std::ifstream file(filename_);
+  if (!file.is_open()) return;
+
+  // every line is "<milliseconds>\t<target>"
+  std::string line;
+  while (std::getline(file, line))
+  {
+    size_t tab_pos = line.find('\t');
+    if (tab_pos == std::string::npos || tab_pos == 0) continue;
+
+    try
+    {
+      durations_[line.substr(tab_pos + 1)] = std::stoull(line.substr(0, tab_pos));
+    }
+    catch (const std::exception&)
+    {
+      continue;
+    }
+  }
+}
+
+void BuildHistory::Save()
+{
+  if (!dirty_) return;
+
+  std::ofstream file(filename_, std::ios::trunc);
+  if (!file.is_open()) return;
+
+  for (const auto& [target, duration] : durations_)
+    file << duration << '\t' << target << '\n';
+  dirty_ = false;
+}
+
+std::optional<uint64_t> BuildHistory::GetDuration(const std::string& target) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = durations_.find(target);
+  if (it == durations_.end()) return std::nullopt;
+  return it->second;
+}
+
+void BuildHistory::Record(const std::string& target, uint64_t duration_ms)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  durations_[target] = duration_ms;
+  dirty_ = true;
+}
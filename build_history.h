@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Wall time of every recipe from previous runs, kept in a small text file
+// next to the Makefile. The scheduler uses it to estimate critical paths.
+class BuildHistory
+{
+  std::string filename_;
+  std::unordered_map<std::string, uint64_t> durations_;
+  bool dirty_ = false;
+  mutable std::mutex mutex_;
+
+public:
+  explicit BuildHistory(std::string filename = ".make_history");
+
+  void Load();
+  void Save();
+
+  std::optional<uint64_t> GetDuration(const std::string& target) const;
+  void Record(const std::string& target, uint64_t duration_ms);
+};
@@ -0,0 +1,68 @@
+#include "build_session.h"
+
+#include "makefile.h"
+
+BuildSession::BuildSession(std::unique_ptr<MakeFile> make)
+  : make_(std::move(make))
+{}
+
+BuildSession::~BuildSession() = default;
+
+std::unique_ptr<BuildSession> BuildSession::Load(const std::string& makefile,
+                                                 const std::vector<std::string>& assignments)
+{
+  auto make = std::make_unique<MakeFile>(makefile, std::vector<std::string>(), assignments);
+  return std::unique_ptr<BuildSession>(new BuildSession(std::move(make)));
+}
+
+std::optional<std::string> BuildSession::DefaultGoal() const
+{
+  const std::vector<std::string>& goals = make_->GetGoals();
+  if (goals.empty())
+    return std::nullopt;
+  return goals.front();
+}
+
+std::vector<std::string> BuildSession::Targets() const
+{
+  return make_->GetTargetNames();
+}
+
+std::optional<TargetInfo> BuildSession::Describe(const std::string& target)
+{
+  Rule* rule = make_->FindRule(target);
+  if (!rule)
+    return std::nullopt;
+
+  TargetInfo info;
+  info.name = target;
+  std::vector<fs::path> scratch;
+  for (const fs::path& dependence : rule->GetDependencies(scratch))
+    info.dependencies.push_back(dependence.string());
+  for (const fs::path& prereq : rule->GetOrderOnlyPrerequisites(scratch))
+    info.order_only.push_back(prereq.string());
+  info.phony = rule->IsPhony();
+  return info;
+}
+
+bool BuildSession::IsUpToDate(const std::string& goal)
+{
+  MakeOptions options;
+  options.question_only = true;
+  return !make_->Build({goal}, options);
+}
+
+bool BuildSession::Build(const std::vector<std::string>& goals, const MakeOptions& options)
+{
+  return make_->Build(goals.empty() ? make_->GetGoals() : goals, options);
+}
+
+void BuildSession::ExportNinja(const std::vector<std::string>& goals, const std::string& filename)
+{
+  make_->ExportNinja(goals.empty() ? make_->GetGoals() : goals, filename);
+}
+
+void BuildSession::ExplainRebuild(const std::vector<std::string>& goals, const std::string& file)
+{
+  make_->ExplainRebuild(goals.empty() ? make_->GetGoals() : goals, file);
+}
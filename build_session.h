@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+class MakeFile;
+
+struct TargetInfo
+{
+  std::string name;
+  std::vector<std::string> dependencies;
+  std::vector<std::string> order_only;
+  bool phony = false;
+};
+
+// The interpreter as a library: a Makefile is read once, and the graph,
+// compiled expressions, variables and build history stay in memory while
+// targets are queried and goals are built any number of times. Calls must
+// not overlap; errors are reported as exceptions, like everywhere else.
+class BuildSession
+{
+  std::unique_ptr<MakeFile> make_;
+
+  explicit BuildSession(std::unique_ptr<MakeFile> make);
+
+public:
+  // assignments are NAME=value strings with command-line priority
+  static std::unique_ptr<BuildSession> Load(const std::string& makefile,
+                                            const std::vector<std::string>& assignments = {});
+  ~BuildSession();
+
+  // the first target of the Makefile, or nothing for an empty one
+  std::optional<std::string> DefaultGoal() const;
+  // targets with an explicit rule, sorted
+  std::vector<std::string> Targets() const;
+  // the prerequisites after vpath search, also for pattern-rule targets;
+  // nothing when no rule makes the target
+  std::optional<TargetInfo> Describe(const std::string& target);
+
+  // true when building the goal would run no recipe; nothing is run
+  bool IsUpToDate(const std::string& goal);
+  // returns true when some recipe had to run (or, with question_only, would)
+  bool Build(const std::vector<std::string>& goals, const MakeOptions& options = {});
+
+  void ExportNinja(const std::vector<std::string>& goals, const std::string& filename);
+  void ExplainRebuild(const std::vector<std::string>& goals, const std::string& file);
+};
@@ -29,6 +29,34 @@ nargparse::ArgumentParser CreateMakeParser(CliOptions& options)
   parser.AddArgument<std::string>("-C", "--directory", &options.directory, "Change to DIRECTORY before doing anything.", 
                                  kNargsOptional, nullptr, "Incorrect directory");
 
+  parser.AddArgument<int>("-j", "--jobs", &options.jobs, "Allow N jobs at once.",
+                         kNargsOptional, [](const int& n) { return n > 0; }, "Jobs count must be positive");
+
+  parser.AddArgument<std::string>("", "--remote", &options.remote_socket, "Run recipes on the worker listening on SOCKET.",
+                                 kNargsOptional, nullptr, "Incorrect socket path");
+
+  parser.AddArgument<std::string>("", "--worker", &options.worker_socket, "Serve recipes from --remote clients on SOCKET.",
+                                 kNargsOptional, nullptr, "Incorrect socket path");
+
+  parser.AddArgument<std::string>("", "--worker-dir", &options.worker_dir, "Run served recipes in job directories below DIR.",
+                                 kNargsOptional, nullptr, "Incorrect directory");
+
+  parser.AddArgument<std::string>("", "--cache-dir", &options.cache_dir, "Reuse recipe outputs stored in DIR.",
+                                 kNargsOptional, nullptr, "Incorrect directory");
+
+  parser.AddArgument<int>("", "--cache-size", &options.cache_size_mb, "Keep at most N megabytes in the cache.",
+                         kNargsOptional, [](const int& n) { return n > 0; }, "Cache size must be positive");
+
+  parser.AddArgument<std::string>("", "--export-ninja", &options.export_ninja, "Write the build graph to FILE as a ninja manifest.",
+                                 kNargsOptional, nullptr, "Incorrect filename");
+
+  parser.AddArgument<std::string>("", "--changed-files", &options.changed_files,
+                                 "Remake only what depends on the comma-separated FILES, without checking timestamps.",
+                                 kNargsOptional, nullptr, "Incorrect file list");
+
+  parser.AddArgument<std::string>("", "--why-rebuild", &options.why_rebuild, "Explain why FILE is out of date and what depends on it.",
+                                 kNargsOptional, nullptr, "Incorrect filename");
+
   parser.AddPositional<std::string>("target", "Target names (optional)", kNargsZeroOrMore);
 
   parser.AddHelp();
@@ -39,6 +67,7 @@ nargparse::ArgumentParser CreateMakeParser(CliOptions& options)
   parser.AddFlag("-i", "--ignore-errors", &options.ignore_errors, "Ignore errors from recipes.");
   parser.AddFlag("-B", "--always-make", &options.always_make, "Unconditionally make all targets.");
   parser.AddFlag("-q", "--question", &options.question, "Run no recipe; exit status says if up to date.");
+  parser.AddFlag("", "--check-parse", &options.check_parse, "Parse the Makefile sequentially and in chunks and compare.");
 
   return parser;
 }
@@ -48,11 +77,34 @@ void CollectCliTargets(nargparse::ArgumentParser& parser, CliOptions& options)
   using namespace nargparse;
   int count = parser.GetRepeatedCount("target");
   options.targets.clear();
+  options.assignments.clear();
   
   for (int i = 0; i < count; i++) 
   {
     std::string target;
-    if (parser.GetRepeated<std::string>("target", i, &target))
+    if (!parser.GetRepeated<std::string>("target", i, &target))
+      continue;
+
+    if (target.find('=') != std::string::npos)
+      options.assignments.push_back(target);
+    else
       options.targets.push_back(target);
   }
-}
\ No newline at end of file
+}
+std::vector<std::string> SplitFileList(const std::string& list)
+{
+  std::vector<std::string> files;
+  std::string current;
+  for (char c : list)
+  {
+    if (c == ',' || c == ' ' || c == '\n')
+    {
+      if (!current.empty()) files.push_back(current);
+      current.clear();
+    }
+    else
+      current += c;
+  }
+  if (!current.empty()) files.push_back(current);
+  return files;
+}
@@ -12,8 +12,17 @@ struct CliOptions
 {
   std::string makefile_name;
   std::string directory;
+  std::string remote_socket;
+  std::string worker_socket;
+  std::string worker_dir;
+  std::string cache_dir;
+  std::string export_ninja;
+  std::string why_rebuild;
+  std::string changed_files;
 
   std::vector<std::string> targets;
+  // NAME=value arguments, they override the Makefile
+  std::vector<std::string> assignments;
 
   bool dry_run = false;
   bool keep_going = false;
@@ -21,8 +30,14 @@ struct CliOptions
   bool always_make = false;
   bool ignore_errors = false;
   bool question = false;
+  bool check_parse = false;
+
+  int jobs = 1;
+  int cache_size_mb = 5120;
 };
 
 nargparse::ArgumentParser CreateMakeParser(CliOptions& options);
 std::string GetMakefileName();
-void CollectCliTargets(nargparse::ArgumentParser& parser, CliOptions& options);
\ No newline at end of file
+void CollectCliTargets(nargparse::ArgumentParser& parser, CliOptions& options);
+// "a.c,b.c" or "a.c b.c"
+std::vector<std::string> SplitFileList(const std::string& list);
\ No newline at end of file
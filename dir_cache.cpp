@@ -0,0 +1,292 @@
+#include "dir_cache.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+#ifdef _WIN32
+  constexpr std::string_view kSeparators = "/\\";
+#else
+  constexpr std::string_view kSeparators = "/";
+#endif
+
+  std::vector<std::string_view> SplitComponents(std::string_view path)
+  {
+    std::vector<std::string_view> components;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+      size_t slash = path.find('/', start);
+      if (slash == std::string_view::npos)
+        slash = path.size();
+      if (slash > start)
+        components.push_back(path.substr(start, slash - start));
+      start = slash + 1;
+    }
+    return components;
+  }
+
+  std::string ListingKey(const std::string& dir)
+  {
+    if (dir.empty()) return ".";
+    if (dir.size() > 1 && dir.back() == '/') return dir.substr(0, dir.size() - 1);
+    return dir;
+  }
+
+  bool ReadDirectory(const std::string& dir, std::vector<std::string>& names)
+  {
+#if defined(__linux__) && defined(SYS_getdents64)
+    struct LinuxDirent64
+    {
+      uint64_t d_ino;
+      int64_t d_off;
+      unsigned short d_reclen;
+      unsigned char d_type;
+      char d_name[1];
+    };
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    alignas(LinuxDirent64) char buffer[1 << 16];
+    while (true)
+    {
+      long got = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+      if (got <= 0) break;
+
+      for (long offset = 0; offset < got;)
+      {
+        auto* entry = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+        std::string_view name(entry->d_name);
+        if (name != "." && name != "..")
+          names.emplace_back(name);
+        offset += entry->d_reclen;
+      }
+    }
+    close(fd);
+    return true;
+#else
+    std::error_code ec;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec))
+      names.push_back(entry.path().filename().string());
+    return !ec;
+#endif
+  }
+
+  std::string JoinPath(const std::string& dir, std::string_view name)
+  {
+    if (dir.empty()) return std::string(name);
+    std::string path = dir;
+    if (path.back() != '/')
+      path += '/';
+    path.append(name);
+    return path;
+  }
+}
+
+bool HasGlobChars(std::string_view text)
+{
+  return text.find_first_of("*?[") != std::string_view::npos;
+}
+
+bool MatchGlob(std::string_view pattern, std::string_view name)
+{
+  // wildcards never match a leading dot, like the shell
+  if (!name.empty() && name[0] == '.' && (pattern.empty() || pattern[0] != '.'))
+    return false;
+
+  size_t p = 0, n = 0;
+  size_t star_p = std::string_view::npos, star_n = 0;
+
+  while (n < name.size())
+  {
+    if (p < pattern.size() && pattern[p] == '*')
+    {
+      star_p = p++;
+      star_n = n;
+      continue;
+    }
+
+    if (p < pattern.size() && pattern[p] == '[')
+    {
+      size_t close = pattern.find(']', p + 2);
+      if (close != std::string_view::npos)
+      {
+        size_t i = p + 1;
+        bool negate = pattern[i] == '!' || pattern[i] == '^';
+        if (negate) i++;
+
+        bool matched = false;
+        for (; i < close; ++i)
+        {
+          if (i + 2 < close && pattern[i + 1] == '-')
+          {
+            matched |= pattern[i] <= name[n] && name[n] <= pattern[i + 2];
+            i += 2;
+          }
+          else
+            matched |= pattern[i] == name[n];
+        }
+
+        if (matched != negate)
+        {
+          p = close + 1;
+          n++;
+          continue;
+        }
+      }
+    }
+    else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+    {
+      p++;
+      n++;
+      continue;
+    }
+
+    if (star_p == std::string_view::npos)
+      return false;
+    p = star_p + 1;
+    n = ++star_n;
+  }
+
+  while (p < pattern.size() && pattern[p] == '*')
+    p++;
+  return p == pattern.size();
+}
+
+DirectoryCache DirectoryCache::At(const std::string& directory) const
+{
+  DirectoryCache view;
+  view.listings_ = listings_;
+  std::string base = fs::path(Resolve(directory)).lexically_normal().string();
+  while (base.size() > 1 && base.back() == '/')
+    base.pop_back();
+  view.base_ = base == "." ? "" : base;
+  return view;
+}
+
+std::string DirectoryCache::Resolve(const std::string& path) const
+{
+  if (base_.empty() || fs::path(path).is_absolute()) return path;
+  if (path.empty() || path == ".") return base_;
+  return JoinPath(base_, path);
+}
+
+std::shared_ptr<const DirectoryCache::Listing> DirectoryCache::List(const std::string& dir)
+{
+  return ListKey(ListingKey(Resolve(dir)));
+}
+
+std::shared_ptr<const DirectoryCache::Listing> DirectoryCache::ListKey(const std::string& key)
+{
+  uint64_t generation;
+
+  {
+    std::lock_guard<std::mutex> lock(listings_->mutex);
+    auto it = listings_->by_dir.find(key);
+    if (it != listings_->by_dir.end())
+      return it->second;
+    generation = listings_->generation;
+  }
+
+  auto listing = std::make_shared<Listing>();
+  ReadDirectory(key, *listing);
+  std::sort(listing->begin(), listing->end());
+
+  std::lock_guard<std::mutex> lock(listings_->mutex);
+  if (generation != listings_->generation)
+    return listing;
+  return listings_->by_dir.emplace(key, std::move(listing)).first->second;
+}
+
+bool DirectoryCache::Exists(const std::string& path)
+{
+  size_t end = path.size();
+  while (end > 1 && kSeparators.find(path[end - 1]) != std::string_view::npos)
+    end--;
+  if (end == 0) return false;
+
+  size_t slash = path.find_last_of(kSeparators, end - 1);
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1, end - (slash == std::string::npos ? 0 : slash + 1));
+  std::string parent = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+
+  if (name == "." || name == "..")
+  {
+    std::error_code ec;
+    return fs::exists(Resolve(path), ec);
+  }
+
+  std::shared_ptr<const Listing> listing = List(parent);
+  return std::binary_search(listing->begin(), listing->end(), name);
+}
+
+void DirectoryCache::Invalidate(const std::string& dir)
+{
+  std::lock_guard<std::mutex> lock(listings_->mutex);
+  listings_->by_dir.erase(ListingKey(Resolve(dir)));
+  listings_->generation++;
+}
+
+void DirectoryCache::Clear()
+{
+  std::lock_guard<std::mutex> lock(listings_->mutex);
+  listings_->by_dir.clear();
+  listings_->generation++;
+}
+
+DirectoryCache::Snapshot DirectoryCache::Listed() const
+{
+  std::lock_guard<std::mutex> lock(listings_->mutex);
+  return Snapshot(listings_->by_dir.begin(), listings_->by_dir.end());
+}
+
+bool DirectoryCache::Unchanged(const Snapshot& snapshot)
+{
+  for (const auto& [key, listing] : snapshot)
+    if (*ListKey(key) != *listing)
+      return false;
+  return true;
+}
+
+std::vector<std::string> DirectoryCache::Glob(std::string_view pattern)
+{
+  std::vector<std::string> candidates = {pattern.starts_with('/') ? "/" : ""};
+
+  for (std::string_view component : SplitComponents(pattern))
+  {
+    std::vector<std::string> next;
+    for (const std::string& dir : candidates)
+    {
+      if (!HasGlobChars(component))
+      {
+        next.push_back(JoinPath(dir, component));
+        continue;
+      }
+
+      std::shared_ptr<const Listing> listing = List(dir);
+      for (const std::string& name : *listing)
+        if (MatchGlob(component, name))
+          next.push_back(JoinPath(dir, name));
+    }
+    candidates = std::move(next);
+    if (candidates.empty()) break;
+  }
+
+  // the last literal components still have to exist
+  std::vector<std::string> result;
+  for (std::string& path : candidates)
+    if (Exists(path))
+      result.push_back(std::move(path));
+
+  std::sort(result.begin(), result.end());
+  return result;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Directory listings read once per run, each with a single getdents64 sweep
+// on Linux. $(wildcard), prerequisite globs, VPATH search and existence
+// checks are answered from the cached names, so asking about a missing file
+// costs no syscalls once its directory has been listed.
+//
+// Relative paths are taken from a base directory, the working directory of
+// the process by default. A make run by a recipe of another one looks at
+// files from its own directory through a view made with At(), which shares
+// the listings.
+class DirectoryCache
+{
+  using Listing = std::vector<std::string>;
+
+  struct Listings
+  {
+    std::unordered_map<std::string, std::shared_ptr<const Listing>> by_dir;
+    // bumped by Invalidate so that a listing read concurrently isn't cached
+    uint64_t generation = 0;
+    std::mutex mutex;
+  };
+
+  std::shared_ptr<Listings> listings_ = std::make_shared<Listings>();
+  std::string base_;
+
+  std::shared_ptr<const Listing> ListKey(const std::string& key);
+
+public:
+  // directories, as the process opens them, to the entries read from them
+  using Snapshot = std::unordered_map<std::string, std::shared_ptr<const Listing>>;
+
+  DirectoryCache() = default;
+  DirectoryCache(DirectoryCache&&) = default;
+  DirectoryCache& operator=(DirectoryCache&&) = default;
+
+  // a view of the same listings from directory, relative to this base
+  DirectoryCache At(const std::string& directory) const;
+  // relative to the working directory of the process, empty for it
+  const std::string& Base() const {return base_;}
+  // path as the process has to open it
+  std::string Resolve(const std::string& path) const;
+
+  // sorted entry names of dir, empty when it can't be read
+  std::shared_ptr<const Listing> List(const std::string& dir);
+
+  bool Exists(const std::string& path);
+
+  // forgets the listing of dir, called after a recipe wrote into it
+  void Invalidate(const std::string& dir);
+  void Clear();
+
+  // the listings read so far
+  Snapshot Listed() const;
+  // whether each directory of snapshot still has the same entries
+  bool Unchanged(const Snapshot& snapshot);
+
+  // existing paths matching a shell pattern with *, ? and [...], sorted
+  std::vector<std::string> Glob(std::string_view pattern);
+};
+
+bool HasGlobChars(std::string_view text);
+bool MatchGlob(std::string_view pattern, std::string_view name);
@@ -0,0 +1,62 @@
+#include "executor.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "process_supervisor.h"
+#include "logger.h"
+
+void Executor::ExecuteAsync(const CommandRequest& request, std::function<void(int)> done)
+{
+  std::thread([this, request, done = std::move(done)]()
+  {
+    // an executor that cannot run the command at all, like a remote one
+    // without its worker, fails it rather than the process
+    int status;
+    try
+    {
+      status = Execute(request);
+    }
+    catch (const std::exception& e)
+    {
+      std::lock_guard<std::mutex> lock(loging::LogMutex());
+      std::cerr << e.what() << '\n';
+      status = -1;
+    }
+    done(status);
+  }).detach();
+}
+
+std::string CommandInDirectory(const std::string& directory, const std::string& command)
+{
+  if (directory.empty()) return command;
+#ifdef _WIN32
+  return "cd /d \"" + directory + "\" && " + command;
+#else
+  std::string quoted = "'";
+  for (char c : directory)
+    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  return "cd " + quoted + "' && " + command;
+#endif
+}
+
+int LocalExecutor::Execute(const CommandRequest& request)
+{
+  return system(CommandInDirectory(request.directory, request.command).c_str());
+}
+
+void LocalExecutor::ExecuteAsync(const CommandRequest& request, std::function<void(int)> done)
+{
+  if (ProcessSupervisor* supervisor = ProcessSupervisor::Instance())
+    supervisor->Spawn(CommandInDirectory(request.directory, request.command), std::move(done));
+  else
+    Executor::ExecuteAsync(request, std::move(done));
+}
+
+Executor& DefaultExecutor()
+{
+  static LocalExecutor executor;
+  return executor;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Everything an executor needs to run one recipe line somewhere else:
+// the fully expanded command and the files it reads and writes.
+struct CommandRequest
+{
+  std::string command;
+  std::vector<std::string> inputs;
+  std::vector<std::string> outputs;
+  // where the command runs and the paths above start, the working directory
+  // of the process when empty
+  std::string directory;
+};
+
+// command for the shell that runs it from directory
+std::string CommandInDirectory(const std::string& directory, const std::string& command);
+
+class Executor
+{
+public:
+  virtual ~Executor() = default;
+
+  // returns the exit status of the command, 0 on success
+  virtual int Execute(const CommandRequest& request) = 0;
+
+  // Starts the command and calls done with its exit status, possibly on
+  // another thread. By default Execute runs on a thread of its own.
+  virtual void ExecuteAsync(const CommandRequest& request, std::function<void(int)> done);
+};
+
+// Runs commands through the system shell of this machine, asynchronous ones
+// under the ProcessSupervisor where it is available.
+class LocalExecutor : public Executor
+{
+public:
+  int Execute(const CommandRequest& request) override;
+  void ExecuteAsync(const CommandRequest& request, std::function<void(int)> done) override;
+};
+
+Executor& DefaultExecutor();
@@ -0,0 +1,254 @@
+#include "expander.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+#include "executor.h"
+#include "functions.h"
+#include "scan_kernels.h"
+#include "word_kernels.h"
+#include "logger.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace
+{
+  // names being expanded on this thread, a self reference expands to nothing
+  thread_local std::vector<std::string> in_progress;
+
+  // the buffers of ScratchString, in use below depth
+  thread_local std::vector<std::unique_ptr<std::string>> scratch_buffers;
+  thread_local size_t scratch_depth = 0;
+
+  std::string& TakeScratch()
+  {
+    if (scratch_depth == scratch_buffers.size())
+      scratch_buffers.push_back(std::make_unique<std::string>());
+    std::string& buffer = *scratch_buffers[scratch_depth++];
+    buffer.clear();
+    return buffer;
+  }
+
+  void AppendSubstituted(std::string_view word, std::string_view from, std::string_view to, std::string& out)
+  {
+    size_t from_pct = from.find('%');
+    if (from_pct == std::string_view::npos)
+    {
+      // $(VAR:.c=.o) replaces a suffix
+      if (word.ends_with(from))
+      {
+        out.append(word.substr(0, word.size() - from.size()));
+        out.append(to);
+      }
+      else
+        out.append(word);
+      return;
+    }
+
+    std::string_view prefix = from.substr(0, from_pct);
+    std::string_view suffix = from.substr(from_pct + 1);
+    if (word.size() < prefix.size() + suffix.size() || !word.starts_with(prefix) || !word.ends_with(suffix))
+    {
+      out.append(word);
+      return;
+    }
+
+    std::string_view stem = word.substr(prefix.size(), word.size() - prefix.size() - suffix.size());
+    size_t to_pct = to.find('%');
+    if (to_pct == std::string_view::npos)
+    {
+      out.append(to);
+      return;
+    }
+    out.append(to.substr(0, to_pct));
+    out.append(stem);
+    out.append(to.substr(to_pct + 1));
+  }
+}
+
+std::optional<VariableRef> MapScope::Lookup(std::string_view name)
+{
+  auto it = vars_.find(std::string(name));
+  if (it == vars_.end())
+    return std::nullopt;
+  return VariableRef{it->second, true};
+}
+
+ScratchString::ScratchString() : buffer_(TakeScratch()) {}
+
+ScratchString::~ScratchString()
+{
+  scratch_depth--;
+}
+
+void BindingScope::Bind(std::string_view name, std::string_view value)
+{
+  // assigning keeps the capacity of the previous value, $(foreach) binds
+  // once per word
+  for (auto& [bound_name, bound_value] : bindings_)
+  {
+    if (bound_name == name)
+    {
+      bound_value.assign(value);
+      return;
+    }
+  }
+  bindings_.emplace_back(name, value);
+}
+
+std::optional<VariableRef> BindingScope::Lookup(std::string_view name)
+{
+  for (const auto& [bound_name, bound_value] : bindings_)
+    if (bound_name == name)
+      return VariableRef{bound_value, false};
+  return parent_.Lookup(name);
+}
+
+std::string Expander::Expand(std::string_view text, VariableScope& scope)
+{
+  std::string out;
+  ExpandInto(text, scope, out);
+  return out;
+}
+
+void Expander::ExpandInto(std::string_view text, VariableScope& scope, std::string& out)
+{
+  if (ScanFind(text, kScanDollar) == std::string_view::npos)
+  {
+    out.append(text);
+    return;
+  }
+  std::shared_ptr<const Expression> expr = expressions_.Get(text);
+  Evaluate(*expr, scope, out);
+}
+
+std::string Expander::Evaluate(const Expression& expr, VariableScope& scope)
+{
+  std::string out;
+  Evaluate(expr, scope, out);
+  return out;
+}
+
+void Expander::Evaluate(const Expression& expr, VariableScope& scope, std::string& out)
+{
+  for (const ExprNode& node : expr)
+  {
+    switch (node.kind)
+    {
+      case ExprNode::Kind::kLiteral:
+        out.append(node.text);
+        break;
+
+      case ExprNode::Kind::kVariable:
+        if (node.args.empty())
+          ExpandVariable(node.text, scope, out);
+        else
+        {
+          ScratchString name;
+          Evaluate(node.args[0], scope, *name);
+          ExpandVariable(*name, scope, out);
+        }
+        break;
+
+      case ExprNode::Kind::kSubstRef:
+      {
+        ScratchString name, value, from, to;
+        Evaluate(node.args[0], scope, *name);
+        ExpandVariable(*name, scope, *value);
+        Evaluate(node.args[1], scope, *from);
+        Evaluate(node.args[2], scope, *to);
+
+        bool first = true;
+        for (std::string_view word : SplitWords(*value))
+        {
+          if (!first) out += ' ';
+          first = false;
+          AppendSubstituted(word, *from, *to, out);
+        }
+        break;
+      }
+
+      case ExprNode::Kind::kFunction:
+        node.function->impl(*this, node.args, scope, out);
+        break;
+    }
+  }
+}
+
+void Expander::ExpandVariable(std::string_view name, VariableScope& scope, std::string& out)
+{
+  std::optional<VariableRef> var = scope.Lookup(name);
+  if (!var) return;
+
+  if (!var->recursive || var->value.find('$') == std::string_view::npos)
+  {
+    out.append(var->value);
+    return;
+  }
+
+  if (std::find(in_progress.begin(), in_progress.end(), name) != in_progress.end())
+    return;
+
+  in_progress.emplace_back(name);
+  try
+  {
+    ExpandInto(var->value, scope, out);
+  }
+  catch (...)
+  {
+    in_progress.pop_back();
+    throw;
+  }
+  in_progress.pop_back();
+}
+
+std::string Expander::RunShell(const std::string& command)
+{
+  if (memoize_shell_)
+  {
+    std::lock_guard<std::mutex> lock(shell_mutex_);
+    auto it = shell_results_.find(command);
+    if (it != shell_results_.end())
+      return it->second;
+  }
+
+  std::string output;
+  FILE* pipe = popen(CommandInDirectory(directories_.Base(), command).c_str(), "r");
+  if (pipe == nullptr)
+    throw loging::MakeException("Cannot run shell command: " + command);
+
+  char buffer[4096];
+  size_t got;
+  while ((got = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    output.append(buffer, got);
+  pclose(pipe);
+
+  // trailing newlines are dropped and the remaining ones become spaces
+  while (!output.empty() && (output.back() == '\n' || output.back() == '\r'))
+    output.pop_back();
+  std::string result;
+  result.reserve(output.size());
+  for (size_t i = 0; i < output.size(); ++i)
+  {
+    if (output[i] == '\r' && i + 1 < output.size() && output[i + 1] == '\n')
+      continue;
+    result += output[i] == '\n' ? ' ' : output[i];
+  }
+
+  if (memoize_shell_)
+  {
+    std::lock_guard<std::mutex> lock(shell_mutex_);
+    shell_results_.emplace(command, result);
+  }
+  return result;
+}
+
+Expander& DefaultExpander()
+{
+  static Expander expander;
+  return expander;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expression.h"
+#include "dir_cache.h"
+
+struct VariableRef
+{
+  std::string_view value;
+  // recursive values are expanded on every reference, simple ones are not
+  bool recursive = true;
+};
+
+// Where variable references are resolved: the parser, a recipe with its
+// automatic variables, or a $(foreach)/$(call) binding on top of another one.
+class VariableScope
+{
+public:
+  virtual ~VariableScope() = default;
+
+  virtual std::optional<VariableRef> Lookup(std::string_view name) = 0;
+};
+
+class MapScope : public VariableScope
+{
+  const std::unordered_map<std::string, std::string>& vars_;
+
+public:
+  explicit MapScope(const std::unordered_map<std::string, std::string>& vars) : vars_(vars) {}
+
+  std::optional<VariableRef> Lookup(std::string_view name) override;
+};
+
+// Simple variables layered over a parent scope.
+class BindingScope : public VariableScope
+{
+  VariableScope& parent_;
+  std::vector<std::pair<std::string, std::string>> bindings_;
+
+public:
+  explicit BindingScope(VariableScope& parent) : parent_(parent) {}
+
+  void Bind(std::string_view name, std::string_view value);
+  std::optional<VariableRef> Lookup(std::string_view name) override;
+};
+
+// A string for an intermediate result that is used up before the code that
+// took it returns. Buffers come from a per-thread stack, nested evaluations
+// take the next one, and each keeps the capacity it grew to, so expanding
+// the same text again allocates nothing.
+class ScratchString
+{
+  std::string& buffer_;
+
+public:
+  ScratchString();
+  ~ScratchString();
+  ScratchString(const ScratchString&) = delete;
+  ScratchString& operator=(const ScratchString&) = delete;
+
+  std::string& operator*() {return buffer_;}
+  std::string* operator->() {return &buffer_;}
+};
+
+class Expander
+{
+  ExpressionCache expressions_;
+  DirectoryCache directories_;
+
+  std::unordered_map<std::string, std::string> shell_results_;
+  std::mutex shell_mutex_;
+  bool memoize_shell_ = false;
+
+  void ExpandVariable(std::string_view name, VariableScope& scope, std::string& out);
+
+public:
+  Expander() = default;
+  // files are looked at, and $(shell) run, from the base of directories
+  explicit Expander(DirectoryCache directories) : directories_(std::move(directories)) {}
+
+  std::string Expand(std::string_view text, VariableScope& scope);
+  void ExpandInto(std::string_view text, VariableScope& scope, std::string& out);
+  void Evaluate(const Expression& expr, VariableScope& scope, std::string& out);
+  std::string Evaluate(const Expression& expr, VariableScope& scope);
+
+  // $(shell) output is reused for identical commands while this is set,
+  // which is the case during parsing
+  void SetShellMemoization(bool enabled) {memoize_shell_ = enabled;}
+  std::string RunShell(const std::string& command);
+
+  DirectoryCache& Directories() {return directories_;}
+};
+
+Expander& DefaultExpander();
@@ -0,0 +1,194 @@
+#include "expression.h"
+
+#include "functions.h"
+#include "scan_kernels.h"
+
+namespace
+{
+  // Index of the bracket that closes the one at open_pos. Only the same
+  // bracket kind is counted, like GNU make does.
+  size_t FindClosing(std::string_view text, size_t open_pos)
+  {
+    char open = text[open_pos];
+    char close = open == '(' ? ')' : '}';
+    int depth = 1;
+    for (size_t i = open_pos + 1; i < text.size(); ++i)
+    {
+      if (text[i] == open)
+        depth++;
+      else if (text[i] == close && --depth == 0)
+        return i;
+    }
+    return std::string_view::npos;
+  }
+
+  // Splits on top level commas, commas in nested brackets are left alone.
+  std::vector<std::string_view> SplitArgs(std::string_view text, size_t max_args)
+  {
+    std::vector<std::string_view> args;
+    int depth = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+      char c = text[i];
+      if (c == '(' || c == '{')
+        depth++;
+      else if ((c == ')' || c == '}') && depth > 0)
+        depth--;
+      else if (c == ',' && depth == 0 && (max_args == 0 || args.size() + 1 < max_args))
+      {
+        args.push_back(text.substr(start, i - start));
+        start = i + 1;
+      }
+    }
+    args.push_back(text.substr(start));
+    return args;
+  }
+
+  // "VAR:from=to" outside of nested references
+  bool SplitSubstRef(std::string_view text, std::string_view* name, std::string_view* from, std::string_view* to)
+  {
+    int depth = 0;
+    size_t colon = std::string_view::npos;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+      char c = text[i];
+      if (c == '(' || c == '{')
+        depth++;
+      else if ((c == ')' || c == '}') && depth > 0)
+        depth--;
+      else if (depth == 0 && c == ':' && colon == std::string_view::npos)
+        colon = i;
+      else if (depth == 0 && c == '=' && colon != std::string_view::npos)
+      {
+        *name = text.substr(0, colon);
+        *from = text.substr(colon + 1, i - colon - 1);
+        *to = text.substr(i + 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void AppendLiteral(Expression& expr, std::string_view text)
+  {
+    if (text.empty()) return;
+    if (!expr.empty() && expr.back().kind == ExprNode::Kind::kLiteral)
+    {
+      expr.back().text.append(text);
+      return;
+    }
+    ExprNode node;
+    node.text.assign(text);
+    expr.push_back(std::move(node));
+  }
+
+  ExprNode CompileVariable(std::string_view name)
+  {
+    ExprNode node;
+    node.kind = ExprNode::Kind::kVariable;
+    if (name.find('$') == std::string_view::npos)
+      node.text.assign(name);
+    else
+      node.args.push_back(CompileExpression(name));
+    return node;
+  }
+
+  ExprNode CompileReference(std::string_view body)
+  {
+    size_t name_end = 0;
+    while (name_end < body.size() && body[name_end] != ' ' && body[name_end] != '\t')
+      name_end++;
+
+    if (name_end < body.size())
+    {
+      const BuiltinFunction* function = FindBuiltinFunction(body.substr(0, name_end));
+      if (function)
+      {
+        size_t args_start = name_end;
+        while (args_start < body.size() && (body[args_start] == ' ' || body[args_start] == '\t'))
+          args_start++;
+
+        ExprNode node;
+        node.kind = ExprNode::Kind::kFunction;
+        node.function = function;
+        for (std::string_view arg : SplitArgs(body.substr(args_start), function->max_args))
+          node.args.push_back(CompileExpression(arg));
+        return node;
+      }
+    }
+
+    std::string_view name, from, to;
+    if (SplitSubstRef(body, &name, &from, &to))
+    {
+      ExprNode node;
+      node.kind = ExprNode::Kind::kSubstRef;
+      node.args.push_back(CompileExpression(name));
+      node.args.push_back(CompileExpression(from));
+      node.args.push_back(CompileExpression(to));
+      return node;
+    }
+
+    return CompileVariable(body);
+  }
+}
+
+Expression CompileExpression(std::string_view text)
+{
+  Expression expr;
+  size_t pos = 0;
+
+  while (pos < text.size())
+  {
+    size_t dollar = ScanFind(text, kScanDollar, pos);
+    if (dollar == std::string_view::npos || dollar + 1 >= text.size())
+    {
+      AppendLiteral(expr, text.substr(pos));
+      break;
+    }
+
+    AppendLiteral(expr, text.substr(pos, dollar - pos));
+
+    char next = text[dollar + 1];
+    if (next == '$')
+    {
+      AppendLiteral(expr, "$");
+      pos = dollar + 2;
+    }
+    else if (next == '(' || next == '{')
+    {
+      size_t close = FindClosing(text, dollar + 1);
+      if (close == std::string_view::npos)
+      {
+        // unterminated references are kept as they are
+        AppendLiteral(expr, text.substr(dollar));
+        break;
+      }
+      expr.push_back(CompileReference(text.substr(dollar + 2, close - dollar - 2)));
+      pos = close + 1;
+    }
+    else
+    {
+      expr.push_back(CompileVariable(text.substr(dollar + 1, 1)));
+      pos = dollar + 2;
+    }
+  }
+  return expr;
+}
+
+bool IsLiteral(const Expression& expr)
+{
+  return expr.empty() || (expr.size() == 1 && expr[0].kind == ExprNode::Kind::kLiteral);
+}
+
+std::shared_ptr<const Expression> ExpressionCache::Get(std::string_view text)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = compiled_.find(std::string(text));
+  if (it != compiled_.end())
+    return it->second;
+
+  auto expr = std::make_shared<const Expression>(CompileExpression(text));
+  compiled_.emplace(std::string(text), expr);
+  return expr;
+}
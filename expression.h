@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct BuiltinFunction;
+struct ExprNode;
+
+// A string with variable references, compiled into the pieces that have to
+// be concatenated: "a $(B) $(patsubst %.c,%.o,$(C))" becomes
+// [literal "a ", variable B, literal " ", function patsubst(...)].
+using Expression = std::vector<ExprNode>;
+
+struct ExprNode
+{
+  enum class Kind
+  {
+    kLiteral,
+    kVariable,     // text holds the name, or args[0] when the name is computed
+    kSubstRef,     // $(VAR:from=to), args are name, from and to
+    kFunction
+  };
+
+  Kind kind = Kind::kLiteral;
+  std::string text;
+  const BuiltinFunction* function = nullptr;
+  std::vector<Expression> args;
+};
+
+Expression CompileExpression(std::string_view text);
+
+// True when the compiled string is plain text without references.
+bool IsLiteral(const Expression& expr);
+
+// Every distinct string is compiled once per run. The cache is shared by the
+// parser and all recipe threads.
+class ExpressionCache
+{
+  std::unordered_map<std::string, std::shared_ptr<const Expression>> compiled_;
+  std::mutex mutex_;
+
+public:
+  std::shared_ptr<const Expression> Get(std::string_view text);
+};
@@ -0,0 +1,445 @@
+#include "functions.h"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+
+#include "expander.h"
+#include "word_kernels.h"
+#include "logger.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  // appends words separated by single spaces
+  class WordWriter
+  {
+    std::string& out_;
+    bool first_ = true;
+
+  public:
+    explicit WordWriter(std::string& out) : out_(out) {}
+
+    std::string& Next()
+    {
+      if (!first_) out_ += ' ';
+      first_ = false;
+      return out_;
+    }
+
+    void Write(std::string_view word) {Next().append(word);}
+  };
+
+  // an argument evaluated into a scratch buffer, held until the function
+  // that asked for it returns
+  class Arg
+  {
+    ScratchString text_;
+
+  public:
+    Arg(Expander& expander, const std::vector<Expression>& args, size_t index, VariableScope& scope)
+    {
+      if (index < args.size())
+        expander.Evaluate(args[index], scope, *text_);
+    }
+
+    const std::string& operator*() {return *text_;}
+    const std::string* operator->() {return &*text_;}
+    operator std::string_view() {return *text_;}
+  };
+
+  std::string_view Strip(std::string_view text)
+  {
+    while (!text.empty() && IsWordSpace(text.front())) text.remove_prefix(1);
+    while (!text.empty() && IsWordSpace(text.back())) text.remove_suffix(1);
+    return text;
+  }
+
+  size_t ParseIndex(const std::string& text, const char* function)
+  {
+    std::string_view stripped = Strip(text);
+    if (stripped.empty() || !std::all_of(stripped.begin(), stripped.end(), [](char c) { return c >= '0' && c <= '9'; }))
+      throw loging::MakeException(std::string("non-numeric argument to '") + function + "' function: '" + text + "'");
+    return std::stoull(std::string(stripped));
+  }
+
+  void FnSubst(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg from(e, args, 0, scope);
+    Arg to(e, args, 1, scope);
+    Arg text(e, args, 2, scope);
+    if (from->empty())
+    {
+      out += *text;
+      return;
+    }
+
+    size_t pos = 0;
+    while (true)
+    {
+      size_t found = text->find(*from, pos);
+      if (found == std::string::npos) break;
+      out.append(*text, pos, found - pos);
+      out += *to;
+      pos = found + from->size();
+    }
+    out.append(*text, pos, std::string::npos);
+  }
+
+  void FnPatsubst(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg pattern(e, args, 0, scope);
+    Arg replacement(e, args, 1, scope);
+    Arg text(e, args, 2, scope);
+    PatsubstWords(Strip(pattern), replacement, SplitWords(text), out);
+  }
+
+  void FnStrip(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg text(e, args, 0, scope);
+    WordWriter writer(out);
+    for (std::string_view word : SplitWords(text))
+      writer.Write(word);
+  }
+
+  void FnFindstring(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg find(e, args, 0, scope);
+    Arg in(e, args, 1, scope);
+    if (in->find(*find) != std::string::npos)
+      out += *find;
+  }
+
+  void FilterImpl(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out, bool keep)
+  {
+    Arg patterns(e, args, 0, scope);
+    Arg text(e, args, 1, scope);
+    FilterWords(SplitWords(patterns), SplitWords(text), keep, out);
+  }
+
+  void FnFilter(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    FilterImpl(e, args, scope, out, true);
+  }
+
+  void FnFilterOut(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    FilterImpl(e, args, scope, out, false);
+  }
+
+  void FnSort(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg text(e, args, 0, scope);
+    std::vector<std::string_view> words = SplitWords(text);
+    SortUniqueWords(words);
+
+    WordWriter writer(out);
+    for (std::string_view word : words)
+      writer.Write(word);
+  }
+
+  void FnWord(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    size_t n = ParseIndex(*Arg(e, args, 0, scope), "word");
+    if (n == 0)
+      throw loging::MakeException("first argument to 'word' function must be greater than 0");
+    Arg text(e, args, 1, scope);
+    std::vector<std::string_view> words = SplitWords(text);
+    if (n <= words.size())
+      out.append(words[n - 1]);
+  }
+
+  void FnWordlist(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    size_t start = ParseIndex(*Arg(e, args, 0, scope), "wordlist");
+    size_t end = ParseIndex(*Arg(e, args, 1, scope), "wordlist");
+    if (start == 0)
+      throw loging::MakeException("invalid first argument to 'wordlist' function");
+    Arg text(e, args, 2, scope);
+    std::vector<std::string_view> words = SplitWords(text);
+
+    WordWriter writer(out);
+    for (size_t i = start; i <= end && i <= words.size(); ++i)
+      writer.Write(words[i - 1]);
+  }
+
+  void FnWords(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    out += std::to_string(SplitWords(Arg(e, args, 0, scope)).size());
+  }
+
+  void FnFirstword(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg text(e, args, 0, scope);
+    std::vector<std::string_view> words = SplitWords(text);
+    if (!words.empty())
+      out.append(words.front());
+  }
+
+  void FnLastword(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg text(e, args, 0, scope);
+    std::vector<std::string_view> words = SplitWords(text);
+    if (!words.empty())
+      out.append(words.back());
+  }
+
+  template<typename Transform>
+  void ForEachWord(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out,
+                   Transform transform)
+  {
+    Arg text(e, args, 0, scope);
+    WordWriter writer(out);
+    for (std::string_view word : SplitWords(text))
+      transform(word, writer);
+  }
+
+  void FnDir(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    ForEachWord(e, args, scope, out, [](std::string_view word, WordWriter& writer) {
+      size_t slash = word.rfind('/');
+      writer.Write(slash == std::string_view::npos ? std::string_view("./") : word.substr(0, slash + 1));
+    });
+  }
+
+  void FnNotdir(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    ForEachWord(e, args, scope, out, [](std::string_view word, WordWriter& writer) {
+      size_t slash = word.rfind('/');
+      writer.Write(slash == std::string_view::npos ? word : word.substr(slash + 1));
+    });
+  }
+
+  void FnSuffix(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    ForEachWord(e, args, scope, out, [](std::string_view word, WordWriter& writer) {
+      size_t dot = word.rfind('.');
+      size_t slash = word.rfind('/');
+      if (dot != std::string_view::npos && (slash == std::string_view::npos || dot > slash))
+        writer.Write(word.substr(dot));
+    });
+  }
+
+  void FnBasename(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    ForEachWord(e, args, scope, out, [](std::string_view word, WordWriter& writer) {
+      size_t dot = word.rfind('.');
+      size_t slash = word.rfind('/');
+      if (dot != std::string_view::npos && (slash == std::string_view::npos || dot > slash))
+        writer.Write(word.substr(0, dot));
+      else
+        writer.Write(word);
+    });
+  }
+
+  void FnAddsuffix(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg suffix(e, args, 0, scope);
+    Arg text(e, args, 1, scope);
+    WordWriter writer(out);
+    for (std::string_view word : SplitWords(text))
+      writer.Next().append(word).append(*suffix);
+  }
+
+  void FnAddprefix(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg prefix(e, args, 0, scope);
+    Arg text(e, args, 1, scope);
+    WordWriter writer(out);
+    for (std::string_view word : SplitWords(text))
+      writer.Next().append(*prefix).append(word);
+  }
+
+  void FnJoin(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg first_text(e, args, 0, scope);
+    Arg second_text(e, args, 1, scope);
+    std::vector<std::string_view> first = SplitWords(first_text);
+    std::vector<std::string_view> second = SplitWords(second_text);
+
+    WordWriter writer(out);
+    for (size_t i = 0; i < std::max(first.size(), second.size()); ++i)
+    {
+      std::string& dest = writer.Next();
+      if (i < first.size()) dest.append(first[i]);
+      if (i < second.size()) dest.append(second[i]);
+    }
+  }
+
+  void FnWildcard(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg patterns(e, args, 0, scope);
+    WordWriter writer(out);
+    for (std::string_view pattern : SplitWords(patterns))
+      for (const std::string& path : e.Directories().Glob(pattern))
+        writer.Write(path);
+  }
+
+  void FnRealpath(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    // relative names start from the directory of this make, which is not
+    // the working directory of the process under a nested $(MAKE) -C
+    const DirectoryCache& dirs = e.Directories();
+    ForEachWord(e, args, scope, out, [&dirs](std::string_view word, WordWriter& writer) {
+      std::error_code ec;
+      fs::path path = fs::canonical(dirs.Resolve(std::string(word)), ec);
+      if (!ec)
+        writer.Write(path.generic_string());
+    });
+  }
+
+  void FnAbspath(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    const DirectoryCache& dirs = e.Directories();
+    ForEachWord(e, args, scope, out, [&dirs](std::string_view word, WordWriter& writer) {
+      std::string path = fs::absolute(dirs.Resolve(std::string(word))).lexically_normal().generic_string();
+      if (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+      writer.Write(path);
+    });
+  }
+
+  void FnIf(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    Arg condition(e, args, 0, scope);
+    size_t branch = Strip(condition).empty() ? 2 : 1;
+    if (branch < args.size())
+      e.Evaluate(args[branch], scope, out);
+  }
+
+  void FnOr(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    // each argument is written in place and taken back when it is blank
+    size_t mark = out.size();
+    for (const Expression& arg : args)
+    {
+      e.Evaluate(arg, scope, out);
+      if (!Strip(std::string_view(out).substr(mark)).empty())
+        return;
+      out.resize(mark);
+    }
+  }
+
+  void FnAnd(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    // each argument is written in place over the one before, so the last
+    // one stays
+    size_t mark = out.size();
+    for (const Expression& arg : args)
+    {
+      out.resize(mark);
+      e.Evaluate(arg, scope, out);
+      if (Strip(std::string_view(out).substr(mark)).empty())
+      {
+        out.resize(mark);
+        return;
+      }
+    }
+  }
+
+  void FnForeach(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    std::string name(Strip(Arg(e, args, 0, scope)));
+    Arg list(e, args, 1, scope);
+    if (args.size() < 3) return;
+
+    BindingScope binding(scope);
+    WordWriter writer(out);
+    for (std::string_view word : SplitWords(list))
+    {
+      binding.Bind(name, word);
+      e.Evaluate(args[2], binding, writer.Next());
+    }
+  }
+
+  void FnCall(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    std::string name(Strip(Arg(e, args, 0, scope)));
+    std::optional<VariableRef> var = scope.Lookup(name);
+    if (!var) return;
+
+    BindingScope binding(scope);
+    binding.Bind("0", name);
+    for (size_t i = 1; i < args.size(); ++i)
+      binding.Bind(std::to_string(i), *Arg(e, args, i, scope));
+
+    if (var->recursive)
+      e.ExpandInto(std::string(var->value), binding, out);
+    else
+      out.append(var->value);
+  }
+
+  void FnValue(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    std::optional<VariableRef> var = scope.Lookup(Strip(Arg(e, args, 0, scope)));
+    if (var)
+      out.append(var->value);
+  }
+
+  void FnShell(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string& out)
+  {
+    out += e.RunShell(*Arg(e, args, 0, scope));
+  }
+
+  void FnError(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string&)
+  {
+    throw loging::MakeException("*** " + *Arg(e, args, 0, scope) + ".  Stop.");
+  }
+
+  void FnWarning(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string&)
+  {
+    loging::LogError(*Arg(e, args, 0, scope));
+  }
+
+  void FnInfo(Expander& e, const std::vector<Expression>& args, VariableScope& scope, std::string&)
+  {
+    Arg message(e, args, 0, scope);
+    std::lock_guard<std::mutex> lock(loging::LogMutex());
+    std::cout << *message << '\n';
+  }
+
+  constexpr std::array kBuiltinFunctions = {
+    BuiltinFunction{"abspath", 1, FnAbspath},
+    BuiltinFunction{"addprefix", 2, FnAddprefix},
+    BuiltinFunction{"addsuffix", 2, FnAddsuffix},
+    BuiltinFunction{"and", 0, FnAnd},
+    BuiltinFunction{"basename", 1, FnBasename},
+    BuiltinFunction{"call", 0, FnCall},
+    BuiltinFunction{"dir", 1, FnDir},
+    BuiltinFunction{"error", 1, FnError},
+    BuiltinFunction{"filter", 2, FnFilter},
+    BuiltinFunction{"filter-out", 2, FnFilterOut},
+    BuiltinFunction{"findstring", 2, FnFindstring},
+    BuiltinFunction{"firstword", 1, FnFirstword},
+    BuiltinFunction{"foreach", 3, FnForeach},
+    BuiltinFunction{"if", 3, FnIf},
+    BuiltinFunction{"info", 1, FnInfo},
+    BuiltinFunction{"join", 2, FnJoin},
+    BuiltinFunction{"lastword", 1, FnLastword},
+    BuiltinFunction{"notdir", 1, FnNotdir},
+    BuiltinFunction{"or", 0, FnOr},
+    BuiltinFunction{"patsubst", 3, FnPatsubst},
+    BuiltinFunction{"realpath", 1, FnRealpath},
+    BuiltinFunction{"shell", 1, FnShell},
+    BuiltinFunction{"sort", 1, FnSort},
+    BuiltinFunction{"strip", 1, FnStrip},
+    BuiltinFunction{"subst", 3, FnSubst},
+    BuiltinFunction{"suffix", 1, FnSuffix},
+    BuiltinFunction{"value", 1, FnValue},
+    BuiltinFunction{"warning", 1, FnWarning},
+    BuiltinFunction{"wildcard", 1, FnWildcard},
+    BuiltinFunction{"word", 2, FnWord},
+    BuiltinFunction{"wordlist", 3, FnWordlist},
+    BuiltinFunction{"words", 1, FnWords},
+  };
+}
+
+const BuiltinFunction* FindBuiltinFunction(std::string_view name)
+{
+  auto it = std::lower_bound(kBuiltinFunctions.begin(), kBuiltinFunctions.end(), name,
+    [](const BuiltinFunction& function, std::string_view value) { return function.name < value; });
+  if (it == kBuiltinFunctions.end() || it->name != name)
+    return nullptr;
+  return &*it;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "expression.h"
+
+class Expander;
+class VariableScope;
+
+// Builtin functions receive their arguments unexpanded, so $(if), $(and),
+// $(or) and $(foreach) can evaluate only what they need.
+using FunctionImpl = void (*)(Expander& expander, const std::vector<Expression>& args,
+                              VariableScope& scope, std::string& out);
+
+struct BuiltinFunction
+{
+  std::string_view name;
+  // commas after the last argument belong to it, 0 means unlimited
+  size_t max_args;
+  FunctionImpl impl;
+};
+
+const BuiltinFunction* FindBuiltinFunction(std::string_view name);
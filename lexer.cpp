@@ -0,0 +1,224 @@
+#include "lexer.h"
+
+#include "scan_kernels.h"
+
+namespace
+{
+  constexpr std::string_view kBlanks = " \t\n\v\f\r";
+
+  std::string_view Trim(std::string_view text)
+  {
+    size_t start = text.find_first_not_of(kBlanks);
+    if (start == std::string_view::npos) return {};
+    size_t end = text.find_last_not_of(kBlanks);
+    return text.substr(start, end - start + 1);
+  }
+
+  std::string_view TrimLeft(std::string_view text)
+  {
+    size_t start = text.find_first_not_of(kBlanks);
+    return start == std::string_view::npos ? std::string_view() : text.substr(start);
+  }
+
+  // "word" alone or followed by a blank
+  bool StartsWithWord(std::string_view text, std::string_view word)
+  {
+    return text.starts_with(word) && (text.size() == word.size() || text[word.size()] == ' ' || text[word.size()] == '\t');
+  }
+
+  // Index just past the reference starting with the '$' at pos. Brackets of
+  // both kinds are counted inside it.
+  size_t SkipReference(std::string_view text, size_t pos)
+  {
+    if (pos + 1 >= text.size()) return text.size();
+    if (text[pos + 1] != '(' && text[pos + 1] != '{') return pos + 2;
+
+    int depth = 1;
+    size_t i = pos + 2;
+    for (; i < text.size() && depth > 0; ++i)
+    {
+      if (text[i] == '(' || text[i] == '{')
+        depth++;
+      else if (text[i] == ')' || text[i] == '}')
+        depth--;
+    }
+    return i;
+  }
+
+  // Top level positions of the characters that decide what a line is. The
+  // scan stops at a comment; after the first '=' only a comment matters.
+  struct Structure
+  {
+    size_t colon = std::string_view::npos;
+    size_t second_colon = std::string_view::npos;
+    size_t equals = std::string_view::npos;
+    size_t bar = std::string_view::npos;
+    size_t end = 0;
+  };
+
+  Structure Scan(std::string_view text, bool comments)
+  {
+    Structure found;
+    found.end = text.size();
+
+    ScanSet comment = comments ? kScanHash : 0;
+    ScanSet set = kScanDollar | kScanColon | kScanEquals | kScanBar | comment;
+    size_t i = 0;
+    while ((i = ScanFind(text, set, i)) != std::string_view::npos)
+    {
+      switch (text[i])
+      {
+        case '$':
+          i = SkipReference(text, i);
+          continue;
+
+        case '#':
+          if (i > 0 && text[i - 1] == '\\')
+            break;
+          found.end = i;
+          return found;
+
+        case '=':
+          found.equals = i;
+          set = kScanDollar | comment;
+          break;
+
+        case ':':
+          if (found.colon == std::string_view::npos)
+            found.colon = i;
+          else if (found.second_colon == std::string_view::npos && found.bar == std::string_view::npos &&
+                   i != found.colon + 1)
+            found.second_colon = i;
+          break;
+
+        case '|':
+          if (found.colon != std::string_view::npos && found.bar == std::string_view::npos)
+            found.bar = i;
+          break;
+      }
+      i++;
+    }
+    return found;
+  }
+
+  // the operator whose '=' is at equals, and where the name before it ends
+  AssignOp OperatorAt(std::string_view text, size_t equals, size_t lowest, size_t& name_end)
+  {
+    name_end = equals;
+    if (equals <= lowest) return AssignOp::kRecursive;
+    switch (text[equals - 1])
+    {
+      case ':': name_end--; return AssignOp::kSimple;
+      case '+': name_end--; return AssignOp::kAppend;
+      case '?': name_end--; return AssignOp::kConditional;
+      default: return AssignOp::kRecursive;
+    }
+  }
+
+  LexedLine LexStatement(std::string_view text, bool comments)
+  {
+    LexedLine lexed;
+    Structure found = Scan(text, comments);
+    std::string_view body = text.substr(0, found.end);
+
+    if (found.equals != std::string_view::npos)
+    {
+      // "a := b" and "a ::= b" have their colons in the operator
+      bool colon_is_operator = found.colon != std::string_view::npos &&
+                               (found.colon + 1 == found.equals ||
+                                (found.colon + 2 == found.equals && body[found.colon + 1] == ':'));
+      if (found.colon == std::string_view::npos || colon_is_operator)
+      {
+        size_t name_end;
+        lexed.op = OperatorAt(body, found.equals, 0, name_end);
+        if (colon_is_operator) name_end = found.colon;
+        lexed.name = Trim(body.substr(0, name_end));
+        lexed.value = TrimLeft(body.substr(found.equals + 1));
+        lexed.kind = lexed.name.empty() ? LineKind::kOther : LineKind::kAssignment;
+        return lexed;
+      }
+
+      size_t name_start = found.colon + 1;
+      if (name_start < body.size() && body[name_start] == ':')
+        name_start++;
+      size_t name_end;
+      lexed.op = OperatorAt(body, found.equals, name_start, name_end);
+      lexed.targets = Trim(body.substr(0, found.colon));
+      lexed.name = Trim(body.substr(name_start, name_end - name_start));
+      lexed.value = TrimLeft(body.substr(found.equals + 1));
+      bool valid = !lexed.targets.empty() && !lexed.name.empty() && lexed.name.find_first_of(kBlanks) == std::string_view::npos;
+      lexed.kind = valid ? LineKind::kTargetAssignment : LineKind::kOther;
+      return lexed;
+    }
+
+    if (found.colon == std::string_view::npos)
+    {
+      lexed.kind = Trim(body).empty() ? LineKind::kComment : LineKind::kOther;
+      return lexed;
+    }
+
+    // "a:: b" is read like "a: b"
+    size_t prerequisites_start = found.colon + 1;
+    if (prerequisites_start < body.size() && body[prerequisites_start] == ':')
+      prerequisites_start++;
+    size_t prerequisites_end = found.bar == std::string_view::npos ? body.size() : found.bar;
+
+    // "targets: target-pattern: prerequisites"
+    if (found.second_colon != std::string_view::npos)
+    {
+      lexed.target_pattern = Trim(body.substr(prerequisites_start, found.second_colon - prerequisites_start));
+      prerequisites_start = found.second_colon + 1;
+    }
+
+    lexed.targets = Trim(body.substr(0, found.colon));
+    if (lexed.targets.ends_with('&'))
+    {
+      lexed.is_grouped = true;
+      lexed.targets = Trim(lexed.targets.substr(0, lexed.targets.size() - 1));
+    }
+    lexed.prerequisites = Trim(body.substr(prerequisites_start, prerequisites_end - prerequisites_start));
+    if (found.bar != std::string_view::npos)
+      lexed.order_only = Trim(body.substr(found.bar + 1));
+    lexed.kind = lexed.targets.empty() ? LineKind::kOther : LineKind::kRule;
+    return lexed;
+  }
+}
+
+LexedLine LexLine(std::string_view line, bool comments)
+{
+  LexedLine lexed;
+  if (line.empty()) return lexed;
+  if (line[0] == '\t')
+  {
+    lexed.kind = LineKind::kRecipe;
+    return lexed;
+  }
+
+  std::string_view text = TrimLeft(line);
+  if (text.empty()) return lexed;
+  if (comments && text[0] == '#')
+  {
+    lexed.kind = LineKind::kComment;
+    return lexed;
+  }
+
+  if (StartsWithWord(text, "vpath"))
+  {
+    std::string_view arguments = text.substr(5);
+    lexed.kind = LineKind::kVpath;
+    lexed.arguments = Trim(arguments.substr(0, Scan(arguments, comments).end));
+    return lexed;
+  }
+
+  if (StartsWithWord(text, "override"))
+  {
+    LexedLine assignment = LexStatement(TrimLeft(text.substr(8)), comments);
+    if (assignment.kind == LineKind::kAssignment)
+    {
+      assignment.is_override = true;
+      return assignment;
+    }
+  }
+
+  return LexStatement(text, comments);
+}
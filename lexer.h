@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string_view>
+
+#include "target_vars.h"
+
+enum class LineKind
+{
+  kBlank,
+  kComment,
+  kRecipe,            // starts with a tab
+  kAssignment,        // [override] NAME op value
+  kTargetAssignment,  // targets: NAME op value
+  kRule,              // targets: [target-pattern:] prerequisites | order-only prerequisites
+  kVpath,             // vpath [pattern [dirs]]
+  kOther,             // nothing make understands, ignored
+};
+
+// A logical line cut into its parts. The views point into the lexed text
+// and have no surrounding blanks, except for an assignment value, which
+// keeps the blanks before a trailing comment like GNU make does. Whether a
+// rule is a pattern rule is only known once its targets are expanded.
+struct LexedLine
+{
+  LineKind kind = LineKind::kBlank;
+  AssignOp op = AssignOp::kRecursive;
+  bool is_override = false;
+  bool is_grouped = false;  // targets &: prerequisites
+
+  std::string_view targets;
+  std::string_view target_pattern;  // set for a static pattern rule
+  std::string_view name;
+  std::string_view value;
+  std::string_view prerequisites;
+  std::string_view order_only;
+  std::string_view arguments;
+};
+
+// Classifies a line in one pass over its structural characters. Colons,
+// '=' and '|' inside $(...) and ${...} don't count, so "a := b:c" is an
+// assignment and "$(SRC:.c=.o): x" a rule. A '#' outside of a reference
+// starts a comment, unless it follows a backslash or comments are off (for
+// NAME=value arguments).
+LexedLine LexLine(std::string_view line, bool comments = true);
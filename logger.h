@@ -3,6 +3,7 @@
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <mutex>
 
 namespace loging 
 {
@@ -20,13 +21,22 @@ public:
   {}
 };
 
+// recipes may finish on several threads at once
+inline std::mutex& LogMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
 inline void LogError(const std::string& message)
 {
+  std::lock_guard<std::mutex> lock(LogMutex());
   std::cerr << MakeMessage(message) << '\n';
 }
 
 inline void LogInfo(const std::string& message)
 {
+  std::lock_guard<std::mutex> lock(LogMutex());
   std::cout << MakeMessage(message) << '\n';
 }
 
@@ -1,9 +1,15 @@
-#include "makefile.h"
+#include "build_session.h"
+#include "parser.h"
 #include "cli.h"
 #include "argparser/argparser.h"
+#include "remote_executor.h"
+#include "artifact_cache.h"
+#include "worker.h"
 #include "logger.h"
 
+#include <algorithm>
 #include <filesystem>
+#include <thread>
 
 int main(int argc, const char* argv[])
 {
@@ -35,6 +41,9 @@ int main(int argc, const char* argv[])
     fs::current_path(options.directory);
   }
   
+  if (!options.worker_socket.empty())
+    return RunWorker(options.worker_socket, options.worker_dir);
+
   if (options.makefile_name.empty())
   {
     options.makefile_name = GetMakefileName();
@@ -46,18 +55,60 @@ int main(int argc, const char* argv[])
     return 1;
   }
   
+  std::shared_ptr<ArtifactCache> cache;
+  if (!options.cache_dir.empty())
+    cache = std::make_shared<ArtifactCache>(options.cache_dir, static_cast<uint64_t>(options.cache_size_mb) << 20);
+
   bool need_rebuild = false;
   try
   {
-    MakeFile make(options.makefile_name, options.targets);
-    need_rebuild = make.Execute(MakeOptions{
-      options.dry_run,
-      options.silent,
-      options.keep_going,
-      options.ignore_errors,
-      options.always_make,
-      options.question
-    });
+    std::shared_ptr<Executor> executor;
+    if (!options.remote_socket.empty())
+      executor = std::make_shared<RemoteExecutor>(options.remote_socket);
+
+    if (options.check_parse)
+    {
+      MakefileParseResult sequential = MakefileParser(options.makefile_name, options.assignments).Parse(1);
+      size_t threads = std::max(2u, std::thread::hardware_concurrency());
+      MakefileParseResult chunked = MakefileParser(options.makefile_name, options.assignments).Parse(threads);
+
+      std::vector<std::string> differences = CompareParseResults(sequential, chunked);
+      for (const std::string& difference : differences)
+        loging::LogError("Chunked parse: " + difference);
+      if (differences.empty())
+        loging::LogInfo("Chunked parse of '" + options.makefile_name + "' matches the sequential one.");
+      return differences.empty() ? 0 : 1;
+    }
+
+    std::unique_ptr<BuildSession> session = BuildSession::Load(options.makefile_name, options.assignments);
+    if (!options.export_ninja.empty())
+    {
+      session->ExportNinja(options.targets, options.export_ninja);
+      return 0;
+    }
+    if (!options.why_rebuild.empty())
+    {
+      session->ExplainRebuild(options.targets, options.why_rebuild);
+      return 0;
+    }
+
+    MakeOptions make_options;
+    make_options.dry_run = options.dry_run;
+    make_options.silent = options.silent;
+    make_options.keep_going = options.keep_going;
+    make_options.ignore_errors = options.ignore_errors;
+    make_options.always_make = options.always_make;
+    make_options.question_only = options.question;
+    make_options.jobs = static_cast<size_t>(options.jobs);
+    make_options.executor = executor;
+    make_options.cache = cache;
+    if (!options.changed_files.empty())
+      make_options.changed_files = SplitFileList(options.changed_files);
+
+    need_rebuild = session->Build(options.targets, make_options);
+
+    if (cache)
+      cache->PrintStats();
 
     if (options.question)
       return need_rebuild ? 1 : 0;
@@ -67,6 +118,8 @@ int main(int argc, const char* argv[])
   catch (const std::exception& e)
   {
     std::cerr << e.what() << '\n';
+    if (cache)
+      cache->PrintStats();
     return 1;
   }
 }
\ No newline at end of file
@@ -1,56 +1,302 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <optional>
+#include <unordered_set>
 
 #include "makefile.h"
 #include "parser.h"
 #include "rule.h"
 #include "pattern_rule.h"
+#include "build_graph.h"
+#include "scheduler.h"
+#include "executor.h"
+#include "ninja_writer.h"
 #include "logger.h"
 
+struct BuildPlan
+{
+  BuildGraph graph;
+  std::unordered_set<std::string> in_progress;
+  // pool names to the graph's pool numbers
+  std::unordered_map<std::string, uint16_t> pools;
+  // the variables of each target, by node id; the rules are shared with
+  // the plans of other goals, which give them their own
+  std::vector<std::shared_ptr<const VariableLayer>> variables;
+};
+
+struct NinjaExport
+{
+  NinjaWriter writer;
+  MakeOptions options;
+  std::unordered_set<std::string> written;
+  std::unordered_set<std::string> in_progress;
+};
+
 namespace
 {
-  std::optional<std::string> MatchPattern(const std::string& pattern, const std::string& target)
+  // the nodes of the given files
+  std::vector<BuildGraph::NodeId> FindFiles(const BuildGraph& graph, const std::vector<std::string>& files)
   {
-    size_t pct = pattern.find('%');
-    if (pct == std::string::npos) return std::nullopt;
+    std::vector<BuildGraph::NodeId> ids;
+    for (const std::string& file : files)
+    {
+      std::string name = fs::path(file).lexically_normal().string();
+      if (std::optional<BuildGraph::NodeId> id = graph.Find(name))
+      {
+        ids.push_back(*id);
+        continue;
+      }
+      // the makefile may spell it differently
+      for (BuildGraph::NodeId id = 0; id < graph.Size(); ++id)
+        if (fs::path(graph.GetName(id)).lexically_normal().string() == name)
+          ids.push_back(id);
+    }
+    return ids;
+  }
+
+  // nodes that have to be remade when the given files changed, found by
+  // following reverse edges only
+  std::vector<bool> AffectedNodes(const BuildGraph& graph, std::vector<BuildGraph::NodeId> pending)
+  {
+    std::vector<bool> affected(graph.Size(), false);
+    while (!pending.empty())
+    {
+      BuildGraph::NodeId id = pending.back();
+      pending.pop_back();
 
-    std::string prefix = pattern.substr(0, pct);
-    std::string suffix = pattern.substr(pct + 1);
+      std::span<const BuildGraph::NodeId> dependents = graph.GetDependents(id);
+      for (size_t i = 0; i < dependents.size(); ++i)
+      {
+        if (!graph.IsNormalDependent(id, i) || affected[dependents[i]]) continue;
+        affected[dependents[i]] = true;
+        pending.push_back(dependents[i]);
+      }
+    }
+    return affected;
+  }
 
-    if (target.size() < prefix.size() + suffix.size()) return std::nullopt;
-    if (!target.starts_with(prefix) || !target.ends_with(suffix)) return std::nullopt;
+  // the time of the newest output of rule, nothing when one is missing
+  std::optional<fs::file_time_type> NewestOutput(const Rule& rule, const DirectoryCache& dirs)
+  {
+    std::optional<fs::file_time_type> newest;
+    for (const fs::path& output : rule.GetOutputs())
+    {
+      std::error_code error;
+      fs::file_time_type mtime = fs::last_write_time(dirs.Resolve(output.string()), error);
+      if (error) return std::nullopt;
+      if (!newest || mtime > *newest)
+        newest = mtime;
+    }
+    return newest;
+  }
 
-    size_t stem_len = target.size() - prefix.size() - suffix.size();
-    return target.substr(prefix.size(), stem_len);
+  std::string Trim(const std::string& text)
+  {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos) return "";
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
   }
 
-  std::string SubstituteStem(const std::string& str, const std::string& stem)
+  // How a recipe line runs $(MAKE): only directory changes, Makefile names,
+  // flags that map onto MakeOptions, assignments and goals.
+  struct SubMake
+  {
+    std::string directory;
+    std::string file;
+    std::vector<std::string> goals;
+    std::vector<std::string> assignments;
+    MakeOptions options;
+  };
+
+  // Recipe lines that only run $(MAKE) are built by a MakeFile in this
+  // process rather than by a new one: no spawn, and the nested make shares
+  // the directory listings, the job tokens and the output of this one.
+  // Everything else, `cd sub && $(MAKE)` included, goes to the executor the
+  // recipes would use anyway.
+  class RecursiveMakeExecutor : public Executor
   {
-    std::string result;
-    result.reserve(str.size() + stem.size());
-    for (size_t i = 0; i < str.size(); ++i)
+    std::string make_;
+    MakeOptions options_;
+    DirectoryCache directories_;
+
+    Executor& Inner() const { return options_.executor ? *options_.executor : DefaultExecutor(); }
+
+    std::optional<SubMake> Parse(const std::string& command) const
     {
-      if (str[i] == '%')
-        result += stem;
-      else
-        result += str[i];
+      size_t start = command.find_first_not_of(" \t");
+      if (start == std::string::npos || command.compare(start, make_.size(), make_) != 0)
+        return std::nullopt;
+      std::string_view rest = std::string_view(command).substr(start + make_.size());
+      if (!rest.empty() && rest[0] != ' ' && rest[0] != '\t')
+        return std::nullopt;
+      // the shell would have something to do
+      if (rest.find_first_of("|&;<>()$`\\\"'*?[]{}#~!\n") != std::string_view::npos)
+        return std::nullopt;
+
+      std::vector<std::string> words;
+      std::istringstream stream{std::string(rest)};
+      for (std::string word; stream >> word;)
+        words.push_back(std::move(word));
+
+      SubMake sub;
+      sub.options = options_;
+      sub.options.variables = nullptr;
+      sub.options.expander = nullptr;
+      sub.options.changed_files = std::nullopt;
+      fs::path directory;
+      for (size_t i = 0; i < words.size(); ++i)
+      {
+        const std::string& word = words[i];
+        auto value = [&](const std::string& flag, const std::string& long_flag) -> std::optional<std::string>
+        {
+          if (word == flag || word == long_flag)
+            return i + 1 < words.size() ? std::optional<std::string>(words[++i]) : std::nullopt;
+          if (word.size() > flag.size() && word.starts_with(flag))
+            return word.substr(flag.size());
+          if (word.starts_with(long_flag + "="))
+            return word.substr(long_flag.size() + 1);
+          return std::nullopt;
+        };
+
+        if (!word.starts_with('-'))
+        {
+          (word.find('=') != std::string::npos ? sub.assignments : sub.goals).push_back(word);
+        }
+        else if (word == "-s" || word == "--silent") sub.options.silent = true;
+        else if (word == "-k" || word == "--keep-going") sub.options.keep_going = true;
+        else if (word == "-i" || word == "--ignore-errors") sub.options.ignore_errors = true;
+        else if (word == "-B" || word == "--always-make") sub.options.always_make = true;
+        else if (std::optional<std::string> dir = value("-C", "--directory")) directory /= *dir;
+        else if (std::optional<std::string> file = value("-f", "--file")) sub.file = *file;
+        // the jobs are the ones of this make
+        else if (value("-j", "--jobs")) {}
+        else return std::nullopt;
+      }
+      sub.directory = directory.string();
+      return sub;
     }
-    return result;
+
+    static int Run(const SubMake& sub, DirectoryCache directories)
+    {
+      std::string directory = directories.Base().empty() ? "." : directories.Base();
+      bool announce = !sub.options.silent && !sub.directory.empty();
+      if (announce)
+        loging::LogInfo("Entering directory '" + directory + "'");
+
+      int status = 0;
+      try
+      {
+        std::string file = sub.file;
+        for (const char* name : {"GNUmakefile", "makefile", "Makefile"})
+          if (file.empty() && directories.Exists(name))
+            file = name;
+        if (file.empty())
+          throw loging::MakeException("No targets makefile found in '" + directory + "'");
+
+        MakeFile make(std::move(directories), file, sub.goals, sub.assignments);
+        bool need_rebuild = make.Execute(sub.options);
+        status = sub.options.question_only && need_rebuild ? 1 : 0;
+      }
+      catch (const std::exception& e)
+      {
+        std::lock_guard<std::mutex> lock(loging::LogMutex());
+        std::cerr << e.what() << '\n';
+        status = 2;
+      }
+
+      if (announce)
+        loging::LogInfo("Leaving directory '" + directory + "'");
+      return status;
+    }
+
+  public:
+    RecursiveMakeExecutor(std::string make, MakeOptions options, const DirectoryCache& directories)
+      : make_(std::move(make))
+      , options_(std::move(options))
+      , directories_(directories.At(""))
+    {}
+
+    int Execute(const CommandRequest& request) override
+    {
+      std::optional<SubMake> sub = Parse(request.command);
+      if (!sub)
+        return Inner().Execute(request);
+      return Run(*sub, directories_.At(sub->directory));
+    }
+
+    void ExecuteAsync(const CommandRequest& request, std::function<void(int)> done) override
+    {
+      std::optional<SubMake> sub = Parse(request.command);
+      if (!sub)
+      {
+        Inner().ExecuteAsync(request, std::move(done));
+        return;
+      }
+      // the nested make waits for its jobs like the outer one does
+      DirectoryCache directories = directories_.At(sub->directory);
+      std::thread([sub = std::move(*sub), directories = std::move(directories), done = std::move(done)]() mutable
+      {
+        done(Run(sub, std::move(directories)));
+      }).detach();
+    }
+  };
+
+  // Rule::OutOfDateReason on the graph, where every file is stat'ed once
+  // however many targets read it
+  std::optional<std::string> OutOfDateReason(BuildGraph& graph, BuildGraph::NodeId id, const MakeOptions& options)
+  {
+    if (options.always_make) return "--always-make is set";
+
+    DirectoryCache& dirs = (options.expander ? *options.expander : DefaultExpander()).Directories();
+    if (!graph.Exists(id, dirs)) return "it does not exist";
+
+    if (graph.HasFlag(id, BuildGraph::kPhony)) return "it is phony";
+
+    fs::file_time_type target_time = graph.GetOldestMtime(id, dirs);
+    for (BuildGraph::NodeId prerequisite : graph.GetPrerequisites(id))
+    {
+      if (!graph.Exists(prerequisite, dirs))
+        return "'" + graph.GetName(prerequisite) + "' does not exist";
+      if (target_time < graph.GetMtime(prerequisite, dirs))
+        return "'" + graph.GetName(prerequisite) + "' is newer";
+    }
+    return std::nullopt;
   }
 }
 
-MakeFile::MakeFile(const std::string& filename, std::vector<std::string> targets)
+MakeFile::MakeFile(const std::string& filename, std::vector<std::string> targets,
+                   const std::vector<std::string>& cli_assignments)
+  : MakeFile(DirectoryCache(), filename, std::move(targets), cli_assignments)
+{}
+
+MakeFile::MakeFile(DirectoryCache directories, const std::string& filename, std::vector<std::string> targets,
+                   const std::vector<std::string>& cli_assignments)
   : executed_targets_(targets)
+  , history_(directories.Resolve(".make_history"))
 {
   try
   {
-    MakefileParser parser(filename);
+    MakefileParser parser(filename, cli_assignments, std::move(directories));
     MakefileParseResult result = parser.Parse();
 
     rules_ = result.rules;
     pattern_rules_ = result.pattern_rules;
-    vars_ = result.vars;
+    variables_ = result.variables;
+    expander_ = result.expander;
+    vpath_ = std::move(result.vpath);
+    target_vars_ = std::move(result.target_vars);
+    pattern_vars_ = std::move(result.pattern_vars);
+    pools_ = std::move(result.pools);
+    not_parallel_ = result.not_parallel;
+    not_parallel_targets_ = std::move(result.not_parallel_targets);
+    restat_all_ = result.restat_all;
+    restat_targets_ = std::move(result.restat_targets);
 
     for (const auto& phony_target : result.phony_targets)
     {
@@ -68,116 +314,583 @@ MakeFile::MakeFile(const std::string& filename, std::vector<std::string> targets
   }
 }
 
+MakeFile::~MakeFile() = default;
+
 Rule* MakeFile::GetRuleForTarget(const std::string& target)
 {
   auto it = rules_.find(target);
   if (it != rules_.end())
     return &it->second;
 
+  std::unordered_set<std::string> in_progress;
+  bool truncated = false;
+  return FindImplicitRule(target, 0, in_progress, truncated);
+}
+
+// GNU make's implicit rule search: the first pattern rule whose
+// prerequisites all exist, have an explicit rule or can be made by pattern
+// rules in turn, at most kMaxImplicitChain deep. Only the pattern and the
+// stem are kept, see Rule. A failure is remembered unless the depth limit
+// or a loop back to a target being searched had a part in it.
+Rule* MakeFile::FindImplicitRule(const std::string& target, size_t depth, std::unordered_set<std::string>& in_progress,
+                                 bool& truncated)
+{
+  constexpr size_t kMaxImplicitChain = 4;
+
   auto impl_it = implicit_rules_.find(target);
   if (impl_it != implicit_rules_.end())
     return &impl_it->second;
+  if (impossible_targets_.contains(target))
+    return nullptr;
+  if (depth == kMaxImplicitChain || in_progress.contains(target))
+  {
+    truncated = true;
+    return nullptr;
+  }
+
+  in_progress.insert(target);
+  DirectoryCache& dirs = expander_->Directories();
+  bool search_truncated = false;
+  auto can_be_made = [&](const std::string& name)
+  {
+    if (rules_.contains(name) || dirs.Exists(name)) return true;
+    if (!vpath_.Empty() && vpath_.Find(name, dirs)) return true;
+    return FindImplicitRule(name, depth + 1, in_progress, search_truncated) != nullptr;
+  };
 
+  Rule* found = nullptr;
   for (const PatternRule& pr : pattern_rules_)
   {
     std::optional<std::string> stem = MatchPattern(pr.target_pattern, target);
     if (!stem) continue;
 
-    std::vector<fs::path> resolved_deps;
-    for (const std::string& dp : pr.deps)
-      resolved_deps.push_back(fs::path(SubstituteStem(dp, *stem)));
-
-    std::vector<fs::path> resolved_order_only;
-    for (const std::string& dp : pr.order_only_deps)
-      resolved_order_only.push_back(fs::path(SubstituteStem(dp, *stem)));
+    auto makeable = [&](const std::string& dep) { return can_be_made(SubstituteStem(dep, *stem)); };
+    if (!std::ranges::all_of(pr.deps, makeable) || !std::ranges::all_of(pr.order_only_deps, makeable))
+      continue;
 
-    std::vector<std::string> substituted_commands;
-    for (const std::string& cmd : pr.commands)
-      substituted_commands.push_back(SubstituteStem(cmd, *stem));
+    found = &implicit_rules_.try_emplace(target, fs::path(target), pr, std::move(*stem)).first->second;
+    break;
+  }
+  in_progress.erase(target);
 
-    Rule rule(fs::path(target), resolved_deps, resolved_order_only, substituted_commands, stem.value());
-    implicit_rules_[target] = rule;
-    return &implicit_rules_[target];
+  if (!found)
+  {
+    if (search_truncated)
+      truncated = true;
+    else
+      impossible_targets_.insert(target);
   }
-  return nullptr;
+  return found;
 }
 
-bool MakeFile::PreBuildRec(Rule& rule, const MakeOptions& options)
+void MakeFile::ResolveVpath(Rule& rule)
 {
-  bool need_rebuild = false;
+  if (vpath_.Empty()) return;
 
-  for (const fs::path& prereq : rule.GetOrderOnlyPrerequisites())
+  // prerequisites that neither exist nor can be made are looked up in
+  // the vpath directories, so that $^ and $< name the found files
+  DirectoryCache& dirs = expander_->Directories();
+  std::vector<fs::path> scratch;
+  std::vector<fs::path> dependencies = rule.GetDependencies(scratch);
+  bool changed = false;
+  for (fs::path& dependence : dependencies)
   {
-    Rule* prereq_rule = GetRuleForTarget(prereq.string());
-    if (prereq_rule)
-      PreBuildRec(*prereq_rule, options);
+    std::string name = dependence.string();
+    if (dirs.Exists(name) || GetRuleForTarget(name)) continue;
+
+    if (std::optional<std::string> found = vpath_.Find(name, dirs))
+    {
+      dependence = *found;
+      changed = true;
+    }
   }
+  if (changed)
+    rule.SetDependencies(std::move(dependencies));
+}
+
+std::shared_ptr<const VariableLayer> MakeFile::TargetVariables(const std::string& target,
+                                                               std::shared_ptr<const VariableLayer> parent)
+{
+  // pattern-specific values first, so that target-specific ones win
+  std::vector<const VariableAssignments*> assignments;
+  for (const auto& [pattern, pattern_assignments] : pattern_vars_)
+    if (MatchPattern(pattern, target))
+      assignments.push_back(&pattern_assignments);
+
+  auto it = target_vars_.find(target);
+  if (it != target_vars_.end())
+    assignments.push_back(&it->second);
+
+  if (assignments.empty())
+    return parent;
+
+  return VariableLayer::Extend(std::move(parent), assignments, *variables_);
+}
+
+std::optional<size_t> MakeFile::PlanRec(const std::string& target, Rule& rule, BuildPlan& plan,
+                                        const std::shared_ptr<const VariableLayer>& parent_vars)
+{
+  if (updated_targets_.contains(target))
+    return std::nullopt;
+
+  if (std::optional<BuildGraph::NodeId> id = plan.graph.Find(target))
+    return *id;
+
+  plan.in_progress.insert(target);
+  ResolveVpath(rule);
 
-  for (const fs::path& dependence : rule.GetDependencies())
+  // prerequisites inherit the variables of the target that needs them
+  std::shared_ptr<const VariableLayer> vars = TargetVariables(target, parent_vars);
+  rule.SetVariables(vars);
+
+  // files without a rule become nodes too, as normal prerequisites, so
+  // that each is stat'ed once
+  std::vector<BuildGraph::NodeId> prerequisites;
+  std::vector<BuildGraph::NodeId> order_only;
+  auto plan_prerequisite = [&](const fs::path& prereq, std::vector<BuildGraph::NodeId>& ids)
   {
-    Rule* dep_rule = GetRuleForTarget(dependence.string());
-    if (dep_rule)
+    std::string name = prereq.string();
+    if (plan.in_progress.contains(name))
     {
-      bool dep_needs = PreBuildRec(*dep_rule, options);
-      if (dep_needs)
-        need_rebuild = true;
+      loging::LogError("Circular " + target + " <- " + name + " dependency dropped.");
+      return;
     }
+
+    std::optional<size_t> prereq_id;
+    if (Rule* prereq_rule = GetRuleForTarget(name))
+      prereq_id = PlanRec(name, *prereq_rule, plan, vars);
+
+    if (prereq_id)
+      ids.push_back(static_cast<BuildGraph::NodeId>(*prereq_id));
+    else if (&ids == &prerequisites)
+      ids.push_back(plan.graph.AddFile(name));
+  };
+
+  std::vector<fs::path> order_only_scratch;
+  for (const fs::path& prereq : rule.GetOrderOnlyPrerequisites(order_only_scratch))
+    plan_prerequisite(prereq, order_only);
+
+  // .WAIT cuts the prerequisites with a rule into segments that start one
+  // after the other; .NOTPARALLEL targets have a .WAIT between all of them
+  std::vector<fs::path> dependency_scratch;
+  const std::vector<fs::path>& dependencies = rule.GetDependencies(dependency_scratch);
+  std::vector<size_t> waits = rule.GetWaits();
+  if (not_parallel_targets_.contains(target))
+  {
+    waits.clear();
+    for (size_t i = 1; i < dependencies.size(); ++i)
+      waits.push_back(i);
   }
 
-  bool this_rule_needs = rule.IsNeedRebuild(options);
-  if (this_rule_needs)
-    need_rebuild = true;
+  std::vector<std::vector<BuildGraph::NodeId>> segments(1);
+  size_t next_wait = 0;
+  for (size_t i = 0; i < dependencies.size(); ++i)
+  {
+    for (; next_wait < waits.size() && waits[next_wait] <= i; ++next_wait)
+      if (!segments.back().empty())
+        segments.emplace_back();
+
+    size_t planned = prerequisites.size();
+    plan_prerequisite(dependencies[i], prerequisites);
+    if (prerequisites.size() > planned && plan.graph.HasFlag(prerequisites.back(), BuildGraph::kHasRule))
+      segments.back().push_back(prerequisites.back());
+  }
+  for (size_t i = 1; i < segments.size(); ++i)
+    plan.graph.AddBarrier(segments[i - 1], segments[i]);
 
-  if (!options.question_only && this_rule_needs)
-    rule.Run(options);
+  plan.in_progress.erase(target);
+
+  BuildGraph::NodeId id = plan.graph.AddTarget(target, rule, prerequisites, order_only,
+                                               history_.GetDuration(target).value_or(0));
+  plan.variables.resize(id + 1);
+  plan.variables[id] = vars;
+  // the other members of a group are made by the same node
+  if (rule.IsGrouped())
+    for (const fs::path& member : rule.GetOutputs())
+      plan.graph.AddAlias(member.string(), id);
+
+  if (std::optional<std::string> pool = PoolOf(target))
+  {
+    auto depth = pools_.find(*pool);
+    if (depth == pools_.end())
+      throw loging::MakeException("Target '" + target + "' is in the undefined pool '" + *pool + "'");
+    auto [pool_it, added] = plan.pools.try_emplace(*pool, 0);
+    if (added)
+      pool_it->second = plan.graph.AddPool(depth->second);
+    plan.graph.SetPool(id, pool_it->second);
+  }
+  return id;
+}
+
+// The pool of a target is set by `.POOL = name` among its own target- and
+// pattern-specific variables. Unlike other variables it is not passed on to
+// prerequisites, or a link pool would take in every compile.
+std::optional<std::string> MakeFile::PoolOf(const std::string& target)
+{
+  std::optional<std::string> pool;
+  auto find_in = [&pool](const VariableAssignments& assignments)
+  {
+    for (const VariableAssignment& assignment : assignments)
+      if (assignment.name == ".POOL")
+        pool = assignment.value;
+  };
+  for (const auto& [pattern, assignments] : pattern_vars_)
+    if (MatchPattern(pattern, target))
+      find_in(assignments);
+  auto it = target_vars_.find(target);
+  if (it != target_vars_.end())
+    find_in(it->second);
+
+  if (!pool) return std::nullopt;
+  std::string name = expander_->Expand(*pool, *variables_);
+  size_t start = name.find_first_not_of(" \t");
+  if (start == std::string::npos) return std::nullopt;
+  return name.substr(start, name.find_last_not_of(" \t") - start + 1);
+}
+
+bool MakeFile::BuildGoal(const std::string& goal, Rule* rule, std::unique_ptr<BuildPlan>& plan,
+                         const MakeOptions& options)
+{
+  DirectoryCache& dirs = expander_->Directories();
+  if (plan)
+  {
+    plan->graph.Reset();
+    for (BuildGraph::NodeId id = 0; id < plan->graph.Size(); ++id)
+      if (Rule* node_rule = plan->graph.GetRule(id))
+        node_rule->SetVariables(plan->variables[id]);
+  }
+  else
+  {
+    auto planned = std::make_unique<BuildPlan>();
+    PlanRec(goal, *rule, *planned, nullptr);
+    planned->graph.Finalize();
+    planned_from_.merge(dirs.Listed());
+    plan = std::move(planned);
+  }
+  BuildGraph& graph = plan->graph;
+
+  std::atomic<bool> need_rebuild = false;
+
+  // With a list of changed files only their cone is remade, and nothing
+  // is stat'ed to find it. A node of the cone is remade once one of its
+  // prerequisites is dirty: a listed file, or a target whose recipe ran,
+  // unless it is a .RESTAT target whose recipe left its outputs alone.
+  std::vector<bool> affected;
+  if (options.changed_files)
+  {
+    std::vector<BuildGraph::NodeId> files = FindFiles(graph, *options.changed_files);
+    for (BuildGraph::NodeId id : files)
+      graph.SetFlag(id, BuildGraph::kDirty);
+    affected = AffectedNodes(graph, std::move(files));
+  }
+
+  // jobs are started from this thread only, so the graph needs no lock
+  auto job = [&](BuildScheduler::NodeId id, BuildScheduler::Completion complete)
+  {
+    bool this_rule_needs;
+    if (options.changed_files)
+    {
+      std::span<const BuildGraph::NodeId> prerequisites = graph.GetPrerequisites(id);
+      this_rule_needs = affected[id] && std::ranges::any_of(prerequisites, [&](BuildGraph::NodeId p) {
+        return graph.HasFlag(p, BuildGraph::kDirty);
+      });
+    }
+    else
+      this_rule_needs = OutOfDateReason(graph, id, options).has_value();
+    if (this_rule_needs)
+    {
+      need_rebuild = true;
+      graph.SetFlag(id, BuildGraph::kDirty);
+    }
+
+    if (options.question_only || !this_rule_needs)
+    {
+      complete(true, nullptr);
+      return;
+    }
+
+    // the outputs as they were, for a .RESTAT target
+    std::optional<std::optional<fs::file_time_type>> before;
+    const std::string& name = graph.GetName(id);
+    if (options.changed_files && !options.dry_run && (restat_all_ || restat_targets_.contains(name)))
+      before = NewestOutput(*graph.GetRule(id), dirs);
+
+    // dependents compare against the time the recipe leaves behind
+    graph.Invalidate(id);
+    auto start = std::chrono::steady_clock::now();
+    graph.GetRule(id)->RunAsync(options, [this, &graph, &options, &dirs, id, before, start, complete](std::exception_ptr error)
+    {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+      if (!error && !options.dry_run)
+        history_.Record(graph.GetName(id), elapsed.count());
+      // every node has a flag byte of its own, and the scheduler reads it
+      // only after this completion
+      if (!error && before && *before && NewestOutput(*graph.GetRule(id), dirs) == *before)
+        graph.ClearFlag(id, BuildGraph::kDirty);
+      complete(!error, error);
+    });
+  };
+
+  if (not_parallel_)
+    BuildScheduler().Run(graph, job, 1, options.keep_going);
+  else
+    BuildScheduler().Run(graph, job, options.jobs, options.keep_going, options.job_tokens.get());
+
+  for (BuildGraph::NodeId id = 0; id < graph.Size(); ++id)
+  {
+    if (!graph.HasFlag(id, BuildGraph::kHasRule)) continue;
+    updated_targets_.insert(graph.GetName(id));
+    for (const fs::path& member : graph.GetRule(id)->GetOutputs())
+      updated_targets_.insert(member.string());
+  }
 
   return need_rebuild;
 }
 
 bool MakeFile::Execute(const MakeOptions& options)
+{
+  return Build(executed_targets_, options);
+}
+
+bool MakeFile::Build(const std::vector<std::string>& goals, const MakeOptions& options)
 {
   MakeOptions run_opts = options;
-  run_opts.vars = vars_;
+  run_opts.variables = variables_;
+  run_opts.expander = expander_;
 
   bool any_need_rebuild = false;
 
-  if (executed_targets_.empty())
+  if (goals.empty())
     throw loging::MakeException("No target rule found");
-  
-  for (const auto& executed_target : executed_targets_)
+
+  // a make run by a recipe shares the job tokens and the directory
+  // listings of the one running it
+  bool outermost = !run_opts.job_tokens;
+  if (outermost)
+    run_opts.job_tokens = std::make_shared<JobTokens>(run_opts.jobs > 1 ? run_opts.jobs - 1 : 0);
+  std::string make = Trim(expander_->Expand("$(MAKE)", *variables_));
+  if (!make.empty())
+    run_opts.executor = std::make_shared<RecursiveMakeExecutor>(make, run_opts, expander_->Directories());
+
+  // The graphs of the goals are kept between builds while the directories
+  // they were planned from hold the same files: pattern rule and VPATH
+  // choices only change when a file appears or goes away. The files on
+  // disk are stat'ed again either way.
+  DirectoryCache& dirs = expander_->Directories();
+  if (outermost)
+    dirs.Clear();
+  if (plans_.empty() || !dirs.Unchanged(planned_from_))
+  {
+    plans_.clear();
+    planned_from_.clear();
+    implicit_rules_.clear();
+    impossible_targets_.clear();
+  }
+  std::vector<std::unique_ptr<BuildPlan>>& goal_plans = plans_[goals];
+  goal_plans.resize(goals.size());
+  bool keep_plans = true;
+  updated_targets_.clear();
+  history_.Load();
+
+  try
   {
-    Rule* target_rule = GetRuleForTarget(executed_target);
-    if (!target_rule)
+    for (size_t i = 0; i < goals.size(); ++i)
     {
-      std::string error = "Can't find " + executed_target;
+      const std::string& executed_target = goals[i];
+      Rule* target_rule = goal_plans[i] ? nullptr : GetRuleForTarget(executed_target);
+      if (!goal_plans[i] && !target_rule)
+      {
+        std::string error = "Can't find " + executed_target;
+        if (run_opts.keep_going)
+        {
+          loging::LogError(error);
+          continue;
+        }
+        throw loging::MakeException(error);
+      }
+
       if (run_opts.keep_going)
       {
-        loging::LogError(error);
-        continue;
+        try
+        {
+          bool need = BuildGoal(executed_target, target_rule, goal_plans[i], run_opts);
+          if (need)
+            any_need_rebuild = true;
+        }
+        catch (const std::exception& e)
+        {
+          keep_plans = false;
+          loging::LogError("Error building target '" + executed_target + "': " + e.what());
+        }
       }
-      throw loging::MakeException(error);
-    }
-    
-    if (run_opts.keep_going)
-    {
-      try
+      else
       {
-        bool need = PreBuildRec(*target_rule, run_opts);
+        bool need = BuildGoal(executed_target, target_rule, goal_plans[i], run_opts);
         if (need)
           any_need_rebuild = true;
       }
-      catch (const std::exception& e)
+    }
+  }
+  catch (...)
+  {
+    plans_.erase(goals);
+    history_.Save();
+    throw;
+  }
+
+  // the goals after a failed one were planned with its targets in them
+  if (!keep_plans)
+    plans_.erase(goals);
+  history_.Save();
+  return any_need_rebuild;
+}
+
+void MakeFile::ExportRec(const std::string& target, Rule& rule, const std::shared_ptr<const VariableLayer>& parent_vars,
+                         NinjaExport& state)
+{
+  if (state.written.contains(target))
+    return;
+
+  // the same resolution as for a build: vpath, inherited variables and
+  // pattern rules instantiated for the stem
+  state.in_progress.insert(target);
+  ResolveVpath(rule);
+  std::shared_ptr<const VariableLayer> vars = TargetVariables(target, parent_vars);
+  rule.SetVariables(vars);
+
+  auto export_prerequisite = [&](const fs::path& prereq)
+  {
+    std::string name = prereq.string();
+    if (state.in_progress.contains(name))
+    {
+      loging::LogError("Circular " + target + " <- " + name + " dependency dropped.");
+      return;
+    }
+    if (Rule* prereq_rule = GetRuleForTarget(name))
+      ExportRec(name, *prereq_rule, vars, state);
+  };
+
+  std::vector<fs::path> dependency_scratch;
+  std::vector<fs::path> order_only_scratch;
+  const std::vector<fs::path>& dependencies = rule.GetDependencies(dependency_scratch);
+  const std::vector<fs::path>& order_only = rule.GetOrderOnlyPrerequisites(order_only_scratch);
+  for (const fs::path& prereq : order_only)
+    export_prerequisite(prereq);
+  for (const fs::path& dependence : dependencies)
+    export_prerequisite(dependence);
+
+  state.in_progress.erase(target);
+  state.written.insert(target);
+
+  // a group is one edge, the other members being implicit outputs
+  std::vector<std::string> implicit_outputs;
+  for (const fs::path& member : rule.GetOutputs())
+    if (state.written.insert(member.string()).second)
+      implicit_outputs.push_back(member.string());
+
+  state.writer.WriteBuild(target, rule.ExpandCommands(state.options), dependencies, order_only, implicit_outputs);
+}
+
+void MakeFile::ExportNinja(const std::vector<std::string>& goals, const std::string& filename)
+{
+  if (goals.empty())
+    throw loging::MakeException("No target rule found");
+
+  NinjaExport state{NinjaWriter(filename), MakeOptions{}, {}, {}};
+  state.options.variables = variables_;
+  state.options.expander = expander_;
+
+  for (const std::string& goal : goals)
+  {
+    Rule* rule = GetRuleForTarget(goal);
+    if (!rule)
+      throw loging::MakeException("Can't find " + goal);
+    ExportRec(goal, *rule, nullptr, state);
+  }
+  state.writer.WriteDefault(goals);
+}
+
+void MakeFile::ExplainRebuild(const std::vector<std::string>& goals, const std::string& file)
+{
+  MakeOptions options;
+  options.variables = variables_;
+  options.expander = expander_;
+
+  BuildPlan plan;
+  for (const std::string& goal : goals)
+    if (Rule* rule = GetRuleForTarget(goal))
+      PlanRec(goal, *rule, plan, nullptr);
+
+  BuildGraph& graph = plan.graph;
+  graph.Finalize();
+
+  std::string name = fs::path(file).lexically_normal().string();
+  std::optional<BuildGraph::NodeId> goal_id = graph.Find(name);
+  if (!goal_id || !graph.HasFlag(*goal_id, BuildGraph::kHasRule))
+  {
+    loging::LogInfo("'" + name + "' is not a target of the goals.");
+  }
+  else
+  {
+    // ids are in topological order, so the reasons of prerequisites are
+    // known by the time a dependent asks
+    std::vector<std::optional<std::string>> reasons(graph.Size());
+    for (BuildGraph::NodeId id = 0; id <= *goal_id; ++id)
+    {
+      if (!graph.HasFlag(id, BuildGraph::kHasRule)) continue;
+      reasons[id] = OutOfDateReason(graph, id, options);
+      for (BuildGraph::NodeId prerequisite : graph.GetPrerequisites(id))
       {
-        loging::LogError("Error building target '" + executed_target + "': " + e.what());
+        if (reasons[id]) break;
+        if (reasons[prerequisite])
+          reasons[id] = "'" + graph.GetName(prerequisite) + "' will be remade";
       }
     }
-    else
+
+    // follow out-of-date prerequisites down to the files that caused it
+    std::vector<std::pair<BuildGraph::NodeId, size_t>> stack = {{*goal_id, 0}};
+    std::unordered_set<BuildGraph::NodeId> explained;
+    while (!stack.empty())
     {
-      bool need = PreBuildRec(*target_rule, run_opts);
-      if (need)
-        any_need_rebuild = true;
+      auto [id, depth] = stack.back();
+      stack.pop_back();
+      if (!explained.insert(id).second) continue;
+
+      const std::string& target = graph.GetName(id);
+      std::string indent(depth * 2, ' ');
+      loging::LogInfo(indent + "'" + target + "' " + (reasons[id] ? "is out of date: " + *reasons[id] : "is up to date."));
+
+      for (BuildGraph::NodeId prerequisite : graph.GetPrerequisites(id))
+        if (reasons[prerequisite])
+          stack.push_back({prerequisite, depth + 1});
     }
   }
 
-  return any_need_rebuild;
-}
\ No newline at end of file
+  // and everything that is remade after it
+  std::vector<bool> affected = AffectedNodes(graph, FindFiles(graph, {name}));
+  std::string remade;
+  for (BuildGraph::NodeId id = 0; id < affected.size(); ++id)
+    if (affected[id])
+      remade += (remade.empty() ? "" : " ") + graph.GetName(id);
+  if (!remade.empty())
+    loging::LogInfo("A change to '" + name + "' remakes: " + remade);
+}
+
+Rule* MakeFile::FindRule(const std::string& target)
+{
+  Rule* rule = GetRuleForTarget(target);
+  if (rule)
+    ResolveVpath(*rule);
+  return rule;
+}
+
+std::vector<std::string> MakeFile::GetTargetNames() const
+{
+  std::vector<std::string> names;
+  names.reserve(rules_.size());
+  for (const auto& [name, rule] : rules_)
+    names.push_back(name);
+  std::sort(names.begin(), names.end());
+  return names;
+}
@@ -1,25 +1,87 @@
 #pragma once
+#include <map>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <optional>
 
 #include "rule.h"
 #include "pattern_rule.h"
 #include "options.h"
+#include "build_history.h"
+#include "expander.h"
+#include "vpath.h"
+#include "variables.h"
+
+struct BuildPlan;
+struct NinjaExport;
 
 class MakeFile
 {
 	std::unordered_map<std::string, Rule> rules_;
 	std::vector<PatternRule> pattern_rules_;
 	std::unordered_map<std::string, Rule> implicit_rules_;
+	// targets no chain of pattern rules can make
+	std::unordered_set<std::string> impossible_targets_;
 	std::vector<std::string> executed_targets_;
-	std::unordered_map<std::string, std::string> vars_;
+	std::shared_ptr<VariableTable> variables_;
+	std::shared_ptr<Expander> expander_;
+	VpathSearch vpath_;
+	std::unordered_map<std::string, VariableAssignments> target_vars_;
+	std::vector<std::pair<std::string, VariableAssignments>> pattern_vars_;
+	std::unordered_set<std::string> updated_targets_;
+	// the graphs of earlier builds, one per goal, by the goals built, and
+	// the directory listings they were planned from
+	std::map<std::vector<std::string>, std::vector<std::unique_ptr<BuildPlan>>> plans_;
+	DirectoryCache::Snapshot planned_from_;
+	std::unordered_map<std::string, size_t> pools_;
+	bool not_parallel_ = false;
+	std::unordered_set<std::string> not_parallel_targets_;
+	bool restat_all_ = false;
+	std::unordered_set<std::string> restat_targets_;
+	BuildHistory history_;
 
-	bool PreBuildRec(Rule& rule, const MakeOptions& options);
+	void ResolveVpath(Rule& rule);
+	std::shared_ptr<const VariableLayer> TargetVariables(const std::string& target,
+	                                                     std::shared_ptr<const VariableLayer> parent);
+	std::optional<size_t> PlanRec(const std::string& target, Rule& rule, BuildPlan& plan,
+	                              const std::shared_ptr<const VariableLayer>& parent_vars);
+	std::optional<std::string> PoolOf(const std::string& target);
+	// plans the goal with rule unless plan was kept from an earlier build
+	bool BuildGoal(const std::string& goal, Rule* rule, std::unique_ptr<BuildPlan>& plan,
+	               const MakeOptions& options);
+	void ExportRec(const std::string& target, Rule& rule, const std::shared_ptr<const VariableLayer>& parent_vars,
+	               NinjaExport& state);
 	Rule* GetRuleForTarget(const std::string& target);
+	Rule* FindImplicitRule(const std::string& target, size_t depth, std::unordered_set<std::string>& in_progress,
+	                       bool& truncated);
 
 public:
-	MakeFile(const std::string& filename, std::vector<std::string> targets);
-	~MakeFile() = default;
+	MakeFile(const std::string& filename, std::vector<std::string> targets,
+	         const std::vector<std::string>& cli_assignments = {});
+	// A make that works from the base directory of directories, which may be
+	// a view of the listings of the make whose recipe runs this one: the
+	// Makefile, its targets and its recipes are relative to that directory.
+	MakeFile(DirectoryCache directories, const std::string& filename, std::vector<std::string> targets,
+	         const std::vector<std::string>& cli_assignments = {});
+	~MakeFile();
+	// rules made from pattern rules point into pattern_rules_
+	MakeFile(const MakeFile&) = delete;
+	MakeFile& operator=(const MakeFile&) = delete;
 
+	// builds the goals given on construction
 	bool Execute(const MakeOptions& options = {});
-};
\ No newline at end of file
+	// may be called any number of times, the parsed graph is reused
+	bool Build(const std::vector<std::string>& goals, const MakeOptions& options = {});
+
+	const std::vector<std::string>& GetGoals() const {return executed_targets_;}
+	// targets with an explicit rule, sorted
+	std::vector<std::string> GetTargetNames() const;
+	// the rule that makes target, instantiated from a pattern rule if needed
+	Rule* FindRule(const std::string& target);
+
+	// writes the graph of the goals as a ninja manifest instead of building it
+	void ExportNinja(const std::vector<std::string>& goals, const std::string& filename);
+	// prints why file is out of date and which targets depend on it
+	void ExplainRebuild(const std::vector<std::string>& goals, const std::string& file);
+};
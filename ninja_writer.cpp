@@ -0,0 +1,164 @@
+#include "ninja_writer.h"
+
+#include <stdexcept>
+#include <string_view>
+
+namespace
+{
+  // $, blanks and colons are special in the paths of a build line
+  std::string EscapePath(const std::string& path)
+  {
+    std::string result;
+    result.reserve(path.size());
+    for (char c : path)
+    {
+      if (c == '$' || c == ' ' || c == ':')
+        result += '$';
+      result += c;
+    }
+    return result;
+  }
+
+  void AppendEscaped(std::string_view text, std::string& out)
+  {
+    for (char c : text)
+    {
+      if (c == '$')
+        out += '$';
+      out += c;
+    }
+  }
+
+  bool IsBlank(char c)
+  {
+    return c == ' ' || c == '\t';
+  }
+
+  // Whole words equal to the target, to all inputs in order or to the first
+  // input become $out, $in and $in_first, so recipes that differ only in
+  // their files share one rule. Ninja substitutes back the same text.
+  std::string GeneralizeCommand(const std::string& command, const std::string& target,
+                                const std::vector<std::filesystem::path>& inputs, bool& uses_first)
+  {
+    std::string all_inputs;
+    for (const std::filesystem::path& input : inputs)
+      all_inputs += (all_inputs.empty() ? "" : " ") + input.string();
+    std::string first_input = inputs.empty() ? std::string() : inputs[0].string();
+
+    std::string_view text = command;
+    auto is_word_at = [&](size_t pos, std::string_view word) {
+      return !word.empty() && text.compare(pos, word.size(), word) == 0 &&
+             (pos + word.size() == text.size() || IsBlank(text[pos + word.size()]));
+    };
+
+    std::string result;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+      if (IsBlank(text[pos]))
+      {
+        result += text[pos++];
+        continue;
+      }
+
+      if (is_word_at(pos, all_inputs))
+      {
+        result += "$in";
+        pos += all_inputs.size();
+        continue;
+      }
+      if (is_word_at(pos, target))
+      {
+        result += "$out";
+        pos += target.size();
+        continue;
+      }
+      if (is_word_at(pos, first_input))
+      {
+        result += "$in_first";
+        uses_first = true;
+        pos += first_input.size();
+        continue;
+      }
+
+      size_t end = pos;
+      while (end < text.size() && !IsBlank(text[end]))
+        end++;
+      AppendEscaped(text.substr(pos, end - pos), result);
+      pos = end;
+    }
+    return result;
+  }
+}
+
+NinjaWriter::NinjaWriter(const std::string& filename)
+  : out_(filename)
+{
+  if (!out_.is_open())
+    throw std::runtime_error("Cannot write file: " + filename);
+  out_ << "# generated by make --export-ninja\n"
+       << "ninja_required_version = 1.3\n\n";
+}
+
+const std::string& NinjaWriter::RuleFor(const std::string& command)
+{
+  auto it = rules_.find(command);
+  if (it != rules_.end())
+    return it->second;
+
+  std::string name = "r" + std::to_string(rules_.size() + 1);
+  out_ << "rule " << name << '\n'
+       << "  command = " << command << "\n\n";
+  return rules_.emplace(command, std::move(name)).first->second;
+}
+
+void NinjaWriter::WriteBuild(const std::string& target, const std::vector<std::string>& commands,
+                             const std::vector<std::filesystem::path>& inputs,
+                             const std::vector<std::filesystem::path>& order_only,
+                             const std::vector<std::string>& implicit_outputs)
+{
+  std::string command;
+  bool uses_first = false;
+  for (const std::string& line : commands)
+    command += (command.empty() ? "" : " && ") + GeneralizeCommand(line, target, inputs, uses_first);
+
+  std::string rule = command.empty() ? "phony" : RuleFor(command);
+
+  out_ << "build " << EscapePath(target);
+  if (!implicit_outputs.empty())
+  {
+    out_ << " |";
+    for (const std::string& output : implicit_outputs)
+      out_ << ' ' << EscapePath(output);
+  }
+  out_ << ": " << rule;
+  for (const std::filesystem::path& input : inputs)
+    out_ << ' ' << EscapePath(input.string());
+  if (!order_only.empty())
+  {
+    out_ << " ||";
+    for (const std::filesystem::path& input : order_only)
+      out_ << ' ' << EscapePath(input.string());
+  }
+  out_ << '\n';
+  if (uses_first)
+  {
+    std::string first;
+    AppendEscaped(inputs[0].string(), first);
+    out_ << "  in_first = " << first << '\n';
+  }
+
+  if (!out_)
+    throw std::runtime_error("Cannot write ninja manifest");
+}
+
+void NinjaWriter::WriteDefault(const std::vector<std::string>& targets)
+{
+  out_ << "\ndefault";
+  for (const std::string& target : targets)
+    out_ << ' ' << EscapePath(target);
+  out_ << '\n';
+  out_.flush();
+  if (!out_)
+    throw std::runtime_error("Cannot write ninja manifest");
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Writes a ninja manifest while the build graph is walked. Recipes that are
+// the same once their target and inputs are replaced by $out and $in share
+// one `rule` block, written right before its first use, so the only state
+// kept besides the file is the command -> rule name table.
+class NinjaWriter
+{
+  std::ofstream out_;
+  std::unordered_map<std::string, std::string> rules_;
+
+  const std::string& RuleFor(const std::string& command);
+
+public:
+  explicit NinjaWriter(const std::string& filename);
+
+  // a target without commands becomes a `phony` edge; implicit_outputs are
+  // the other members of a grouped target
+  void WriteBuild(const std::string& target, const std::vector<std::string>& commands,
+                  const std::vector<std::filesystem::path>& inputs,
+                  const std::vector<std::filesystem::path>& order_only,
+                  const std::vector<std::string>& implicit_outputs = {});
+  void WriteDefault(const std::vector<std::string>& targets);
+};
@@ -1,7 +1,16 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <optional>
 #include <string>
-#include <unordered_map>
+#include <vector>
+
+class Executor;
+class ArtifactCache;
+class JobTokens;
+class Expander;
+class VariableTable;
 
 struct MakeOptions 
 {
@@ -11,6 +20,19 @@ struct MakeOptions
   bool ignore_errors = false;
   bool always_make = false;
   bool question_only = false;
-  std::unordered_map<std::string, std::string> vars;
+  size_t jobs = 1;
+  // recipes run through DefaultExecutor() when this is empty
+  std::shared_ptr<Executor> executor;
+  // recipes are looked up in and stored to this cache when it is set
+  std::shared_ptr<ArtifactCache> cache;
+  // shares compiled expressions and $(wildcard) listings with the parser
+  std::shared_ptr<Expander> expander;
+  // global variables, DefaultVariables() when this is empty
+  std::shared_ptr<VariableTable> variables;
+  // when set, exactly the targets depending on these files are remade
+  std::optional<std::vector<std::string>> changed_files;
+  // shared with the makes that recipes run in process; made by the
+  // outermost make when empty
+  std::shared_ptr<JobTokens> job_tokens;
 };
 
@@ -1,403 +1,604 @@
 #include "parser.h"
 
-#include <cctype>
-#include <set>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <fstream>
 #include <sstream>
+#include <thread>
 #include <utility>
 
-#ifdef _WIN32
-#include <windows.h>
-#else
-extern char **environ;
-#endif
+#include "lexer.h"
+#include "logger.h"
+#include "word_kernels.h"
+
+// What one rule header defines, with its parts already expanded.
+struct RuleHeader
+{
+  std::vector<Rule> rules;
+  std::vector<PatternRule> pattern_rules;
+  std::vector<std::string> warnings;
+};
 
 namespace
 {
-  std::string LTrim(const std::string& str)
+  // files this large are parsed in chunks when no thread count is given
+  constexpr size_t kChunkedParseMinBytes = 1 << 20;
+
+  std::string Trim(std::string_view text)
   {
     size_t start = 0;
-    while (start < str.size() && std::isspace(static_cast<unsigned char>(str[start])))
+    size_t end = text.size();
+    while (start < end && IsWordSpace(text[start]))
       start++;
-    return str.substr(start, str.size() - start);
+    while (end > start && IsWordSpace(text[end - 1]))
+      end--;
+    return std::string(text.substr(start, end - start));
   }
 
-  std::string RTrim(const std::string& str)
+  std::string TrimLeft(std::string_view text)
   {
-    if (str.empty()) return str;
-    size_t end = str.size();
-    while (end > 0 && std::isspace(static_cast<unsigned char>(str[end - 1])))
-      end--;
-    return str.substr(0, end);
+    size_t start = 0;
+    while (start < text.size() && IsWordSpace(text[start]))
+      start++;
+    return std::string(text.substr(start));
   }
 
-  std::vector<std::string> ParseCommands(std::ifstream& file)
+  // Reads the physical lines [pos, end) like std::getline reads a file.
+  struct LineCursor
   {
-    std::vector<std::string> commands;
-    std::string line;
+    const std::vector<std::string_view>& lines;
+    size_t pos;
+    size_t end;
 
-    auto current_pos = file.tellg();
+    bool Next(std::string& line)
+    {
+      if (pos >= end) return false;
+      line.assign(lines[pos++]);
+      return true;
+    }
+  };
 
-    while (std::getline(file, line))
+  std::vector<std::string_view> SplitLines(std::string_view text)
+  {
+    std::vector<std::string_view> lines;
+    size_t start = 0;
+    while (start < text.size())
     {
-      std::string trimmed = LTrim(line);
-      if (line.empty() || (!trimmed.empty() && trimmed[0] == '#')) continue;
+      size_t newline = text.find('\n', start);
+      if (newline == std::string_view::npos)
+        newline = text.size();
+      lines.push_back(text.substr(start, newline - start));
+      start = newline + 1;
+    }
+    return lines;
+  }
 
-      if (line[0] == '\t')
-        commands.push_back(trimmed);
-      else
-      {
-        file.seekg(current_pos);
+  // a line with its backslash continuations joined
+  bool NextLogicalLine(LineCursor& cursor, std::string& line)
+  {
+    if (!cursor.Next(line)) return false;
+    while (line.ends_with('\\'))
+    {
+      line.pop_back();
+      std::string next_line;
+      if (!cursor.Next(next_line))
         break;
-      }
+      line += next_line;
     }
-
-    return commands;
+    return true;
   }
 
-  Rule ParseRule(std::string& line, std::ifstream& file)
+  // blank or a comment, which a recipe may have in between its lines
+  bool IsRecipeFiller(std::string_view line)
   {
-    size_t delimetr_pos = line.find(':');
-    if (delimetr_pos == std::string::npos) return Rule();
-
-    fs::path target = RTrim(line.substr(0, delimetr_pos));
+    size_t first = line.find_first_not_of(" \t\n\v\f\r");
+    return first == std::string_view::npos || line[first] == '#';
+  }
 
-    std::string deps_str = LTrim(line.substr(delimetr_pos + 1, line.size()));
-    size_t vert_bar_pos = deps_str.find('|');
-    
-    std::vector<fs::path> dependences;
-    if (vert_bar_pos != std::string::npos)
-    {
-      std::string normal_deps = RTrim(deps_str.substr(0, vert_bar_pos));
-      std::istringstream iss(normal_deps);
-      fs::path dependence;
-      while (iss >> dependence) dependences.push_back(dependence);
-    }
-    else
-    {
-      std::istringstream iss(deps_str);
-      fs::path dependence;
-      while (iss >> dependence) dependences.push_back(dependence);
-    }
+  std::vector<std::string> ParseCommands(LineCursor& cursor)
+  {
+    std::vector<std::string> commands;
 
-    std::vector<fs::path> prereqs;
-    if (vert_bar_pos != std::string::npos)
+    while (cursor.pos < cursor.end)
     {
-      std::string prereqs_str = LTrim(deps_str.substr(vert_bar_pos + 1));
-      std::istringstream iss(prereqs_str);
-      fs::path prereq;
-      while (iss >> prereq) prereqs.push_back(prereq);
+      std::string_view line = cursor.lines[cursor.pos];
+      if (!IsRecipeFiller(line))
+      {
+        if (line[0] != '\t') break;
+        commands.push_back(TrimLeft(line));
+      }
+      cursor.pos++;
     }
 
-    std::vector<std::string> commands = ParseCommands(file);
-
-    return Rule(target, dependences, prereqs, commands);
+    return commands;
   }
 
-  PatternRule ParsePatternRule(std::string& line, std::ifstream& file)
+  // A line the main loop always starts on, whatever came before: it is not
+  // a recipe line, a comment or blank, and doesn't continue the line above.
+  // A recipe stops before such a line too.
+  bool IsStatementStart(const std::vector<std::string_view>& lines, size_t i)
   {
-    size_t delim_pos = line.find(':');
-    if (delim_pos == std::string::npos) return PatternRule();
+    std::string_view line = lines[i];
+    if (line.empty() || line[0] == '\t' || IsRecipeFiller(line)) return false;
+    return i == 0 || !lines[i - 1].ends_with('\\');
+  }
 
-    std::string target_pattern = RTrim(line.substr(0, delim_pos));
-    if (target_pattern.find('%') == std::string::npos) return PatternRule();
+  // Prerequisite words with wildcards become the matching files, a
+  // pattern that matches nothing is kept as written. A .WAIT is dropped,
+  // and where it stood is recorded in waits if given.
+  void AppendPrerequisites(std::string_view words, DirectoryCache& dirs, std::vector<fs::path>& out,
+                           std::vector<size_t>* waits = nullptr)
+  {
+    for (std::string_view word : SplitWords(words))
+    {
+      if (word == ".WAIT")
+      {
+        if (waits) waits->push_back(out.size());
+        continue;
+      }
+      if (!HasGlobChars(word))
+      {
+        out.emplace_back(word);
+        continue;
+      }
+      std::vector<std::string> matches = dirs.Glob(word);
+      if (matches.empty())
+        out.emplace_back(word);
+      else
+        out.insert(out.end(), matches.begin(), matches.end());
+    }
+  }
 
-    std::string deps_str = LTrim(line.substr(delim_pos + 1, line.size()));
-    size_t vert_bar_pos = deps_str.find('|');
+  Rule MakeRule(const std::string& target, std::string_view prerequisites, std::string_view order_only,
+                std::shared_ptr<const Recipe> commands, DirectoryCache& dirs, std::string stem = "")
+  {
+    std::vector<fs::path> dependences;
+    std::vector<size_t> waits;
+    AppendPrerequisites(prerequisites, dirs, dependences, &waits);
+    std::vector<fs::path> prereqs;
+    AppendPrerequisites(order_only, dirs, prereqs);
+    Rule rule(target, std::move(dependences), std::move(prereqs), std::move(commands), std::move(stem));
+    rule.SetWaits(std::move(waits));
+    return rule;
+  }
 
+  PatternRule MakePatternRule(const std::string& target_pattern, std::string_view prerequisites,
+                              std::string_view order_only, std::vector<std::string> commands)
+  {
     std::vector<std::string> deps;
-    if (vert_bar_pos != std::string::npos)
+    for (std::string_view word : SplitWords(prerequisites))
+      deps.emplace_back(word);
+    std::vector<std::string> order_only_deps;
+    for (std::string_view word : SplitWords(order_only))
+      order_only_deps.emplace_back(word);
+    return PatternRule(target_pattern, std::move(deps), std::move(order_only_deps), std::move(commands));
+  }
+
+  // every word with its '%' replaced by stem
+  std::string SubstituteWords(std::string_view words, const std::string& stem)
+  {
+    std::string result;
+    for (std::string_view word : SplitWords(words))
     {
-      std::string normal_deps = RTrim(deps_str.substr(0, vert_bar_pos));
-      std::istringstream iss(normal_deps);
-      std::string dep;
-      while (iss >> dep) deps.push_back(dep);
+      if (!result.empty()) result += ' ';
+      result += SubstituteStem(std::string(word), stem);
     }
-    else
+    return result;
+  }
+
+  // Every target of the header gets a rule of its own, all sharing one
+  // recipe. In "targets: target-pattern: prerequisites" the stem of each
+  // target is matched here, so the rules are explicit ones and looking
+  // them up is a plain hash hit. The rules of "targets &: prerequisites"
+  // also share the list of the group's members.
+  RuleHeader MakeRules(std::string_view targets, std::string_view target_pattern, std::string_view prerequisites,
+                       std::string_view order_only, std::vector<std::string> commands, bool grouped,
+                       DirectoryCache& dirs)
+  {
+    RuleHeader header;
+    std::vector<std::string_view> words = SplitWords(targets);
+    if (words.size() == 1 && target_pattern.empty() && words[0].find('%') != std::string_view::npos)
     {
-      std::istringstream iss(deps_str);
-      std::string dep;
-      while (iss >> dep) deps.push_back(dep);
+      header.pattern_rules.push_back(MakePatternRule(std::string(words[0]), prerequisites, order_only, std::move(commands)));
+      return header;
     }
 
-    std::vector<std::string> order_only_deps;
-    if (vert_bar_pos != std::string::npos)
+    auto recipe = std::make_shared<const Recipe>(std::move(commands));
+    std::string pattern(target_pattern);
+    for (std::string_view word : words)
     {
-      std::string prereqs_str = LTrim(deps_str.substr(vert_bar_pos + 1));
-      std::istringstream iss(prereqs_str);
-      std::string prereq;
-      while (iss >> prereq) order_only_deps.push_back(prereq);
+      std::string target(word);
+      if (pattern.empty())
+      {
+        if (target.find('%') != std::string::npos)
+          header.pattern_rules.push_back(MakePatternRule(target, prerequisites, order_only, *recipe));
+        else
+          header.rules.push_back(MakeRule(target, prerequisites, order_only, recipe, dirs));
+        continue;
+      }
+
+      std::optional<std::string> stem = MatchPattern(pattern, target);
+      if (!stem)
+      {
+        header.warnings.push_back("target '" + target + "' doesn't match the target pattern");
+        header.rules.push_back(MakeRule(target, {}, {}, recipe, dirs));
+        continue;
+      }
+      std::string target_prerequisites = SubstituteWords(prerequisites, *stem);
+      std::string target_order_only = SubstituteWords(order_only, *stem);
+      header.rules.push_back(MakeRule(target, target_prerequisites, target_order_only, recipe, dirs, std::move(*stem)));
     }
 
-    std::vector<std::string> commands = ParseCommands(file);
-    return PatternRule(target_pattern, deps, order_only_deps, commands);
+    if (grouped && header.rules.size() > 1)
+    {
+      auto group = std::make_shared<std::vector<fs::path>>();
+      for (const Rule& rule : header.rules)
+        group->push_back(rule.GetTarget());
+      for (Rule& rule : header.rules)
+        rule.SetGroup(group);
+    }
+    return header;
   }
 
-  std::vector<std::string> ParsePhonyTargets(std::string line)
+  // targets whose prerequisites are settings, read by the sequential pass
+  bool IsSpecialTarget(std::string_view targets)
   {
-    std::vector<std::string> result;
-    std::string targets = LTrim(line.substr(6, line.size()));
-    if (targets.empty()) return result;
-
-    std::istringstream iss(targets);
-    std::string target;
-    while (iss >> target) result.push_back(target);
-
-    return result;
+    return targets == ".PHONY" || targets == ".POOL" || targets == ".NOTPARALLEL" || targets == ".RESTAT";
   }
 
-  std::pair<std::string, std::string> ParseLazyVar(const std::string& line)
+  // .POOL: name depth
+  void ParsePool(std::string_view args, MakefileParseResult& result)
   {
-    size_t eq_pos = line.find('=');
-    if (eq_pos == std::string::npos)
-      return {};
-    
-    std::string name = RTrim(line.substr(0, eq_pos));
-    std::string value = LTrim(line.substr(eq_pos + 1));
-    return {name, value};
+    std::vector<std::string_view> words = SplitWords(args);
+    size_t depth = 0;
+    if (words.size() == 2)
+      std::from_chars(words[1].data(), words[1].data() + words[1].size(), depth);
+    if (depth == 0)
+      throw std::runtime_error(".POOL needs a name and a positive depth, got '" + std::string(args) + "'");
+    result.pools[std::string(words[0])] = depth;
   }
 
-  std::pair<std::string, std::string> ParseImVar(const std::string& line)
+  // vpath pattern dirs | vpath pattern | vpath
+  void ParseVpathDirective(const std::string& args, VpathSearch& vpath)
   {
-    size_t delim_pos = line.find(":=");
-    if (delim_pos == std::string::npos)
-      return {};
-      
-    std::string name = RTrim(line.substr(0, delim_pos));
-    std::string value = LTrim(line.substr(delim_pos + 2));
-    return {name, value};
+    std::vector<std::string_view> words = SplitWords(args);
+    if (words.empty())
+    {
+      vpath.ClearPatterns();
+      return;
+    }
+
+    std::string pattern(words[0]);
+    std::string dirs = Trim(std::string_view(args).substr(words[0].data() + words[0].size() - args.data()));
+    if (dirs.empty())
+      vpath.ClearPattern(pattern);
+    else
+      vpath.AddPattern(pattern, dirs);
   }
 
-  std::pair<std::string, std::string> ParseConditionalVar(const std::string& line)
+  VariableAssignment MakeAssignment(const LexedLine& lexed)
   {
-    size_t delim_pos = line.find("?=");
-    if (delim_pos == std::string::npos)
-      return {};
-    
-    std::string name = RTrim(line.substr(0, delim_pos));
-    std::string value = LTrim(line.substr(delim_pos + 2));
-    return {name, value};
+    return VariableAssignment{std::string(lexed.name), std::string(lexed.value), lexed.op};
   }
 
-  bool FindVariable(const std::string& str, size_t pos,
-                        size_t* dollar, std::string* var_name,
-                        size_t* end)
+  // The lines from one statement start to the next, and the rule read from
+  // them when that could be done out of order.
+  struct ParsedUnit
   {
-    while (pos < str.size())
-    {
-      size_t dollar_pos = str.find('$', pos);
-      if (dollar_pos == std::string::npos || dollar_pos + 1 >= str.size())
-        return false;
-
-      size_t var_start = 0;
-      size_t var_end = 0;
+    size_t begin = 0;
+    size_t end = 0;
+    std::optional<RuleHeader> header;
+  };
+
+  // A rule line without references or wildcards reads the same wherever it
+  // is in the file, so it needs none of the state built by the lines above
+  // it. Everything else is left to the sequential pass.
+  void ParseLiteralRule(const std::vector<std::string_view>& lines, DirectoryCache& dirs, ParsedUnit& unit)
+  {
+    LineCursor cursor{lines, unit.begin, unit.end};
+    std::string line;
+    if (!NextLogicalLine(cursor, line) || line.find_first_of("$*?[") != std::string::npos) return;
 
-      if (str[dollar_pos + 1] == '(')
-      {
-        var_start = dollar_pos + 2;
-        var_end = str.find(')', var_start);
-      }
-      else if (str[dollar_pos + 1] == '{')
-      {
-        var_start = dollar_pos + 2;
-        var_end = str.find('}', var_start);
-      }
-      else
-      {
-        pos = dollar_pos + 1;
-        continue;
-      }
+    LexedLine lexed = LexLine(line);
+    if (lexed.kind != LineKind::kRule || IsSpecialTarget(lexed.targets)) return;
 
-      if (var_end == std::string::npos)
-      {
-        pos = dollar_pos + 1;
-        continue;
-      }
+    std::vector<std::string> commands = ParseCommands(cursor);
+    if (cursor.pos != unit.end) return;
 
-      *dollar = dollar_pos;
-      *var_name = str.substr(var_start, var_end - var_start);
-      *end = var_end + 1;
-      return true;
-    }
-    return false;
+    unit.header = MakeRules(lexed.targets, lexed.target_pattern, lexed.prerequisites, lexed.order_only,
+                            std::move(commands), lexed.is_grouped, dirs);
   }
-
 }
 
-MakefileParser::MakefileParser(const std::string& filename)
+MakefileParser::MakefileParser(const std::string& filename, const std::vector<std::string>& cli_assignments,
+                               DirectoryCache directories)
+  : expander_(std::make_shared<Expander>(std::move(directories)))
+  , variables_(std::make_shared<VariableTable>())
 {
-  file_.open(filename);
-  if (!file_.is_open())
+  std::ifstream file(expander_->Directories().Resolve(filename));
+  if (!file.is_open())
     throw std::runtime_error("Cannot open file: " + filename);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  text_ = std::move(contents).str();
+  lines_ = SplitLines(text_);
+
+  for (const std::string& text : cli_assignments)
+  {
+    LexedLine lexed = LexLine(text, false);
+    if (lexed.kind == LineKind::kAssignment)
+      Assign(MakeAssignment(lexed), VariableOrigin::kCommandLine);
+  }
 }
 
-std::string MakefileParser::ExpandVariables(std::string str, std::set<std::string>* in_progress)
+std::string MakefileParser::ExpandVariables(std::string_view str)
 {
-  std::set<std::string> local;
-  std::set<std::string>* ip = in_progress ? in_progress : &local;
+  return expander_->Expand(str, *variables_);
+}
 
-  size_t pos = 0;
-  size_t dollar, end_pos;
-  std::string var_name;
+MakefileParseResult MakefileParser::Parse(size_t threads)
+{
+  MakefileParseResult result;
+  expander_->SetShellMemoization(true);
 
-  while (FindVariable(str, pos, &dollar, &var_name, &end_pos))
-  {
-    std::string replacement;
+  if (threads == 0)
+    threads = text_.size() >= kChunkedParseMinBytes ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+  if (threads > 1)
+    ParseChunked(threads, result);
+  else
+    ParseLines(0, lines_.size(), result);
 
-    if (ip->count(var_name))
-    {
-      replacement = "";
-    }
-    else
-    {
-      ip->insert(var_name);
-      auto im_it = im_var_.find(var_name);
-      auto lazy_it = lazy_vars_.find(var_name);
-      if (im_it != im_var_.end())
-        replacement = im_it->second;
-      else if (lazy_it != lazy_vars_.end())
-        replacement = ExpandVariables(lazy_it->second, ip);
-      else
-        replacement = "";
-      ip->erase(var_name);
-    }
+  if (variables_->Find("VPATH"))
+    result.vpath.SetGeneral(ExpandVariables("$(VPATH)"));
 
-    str.replace(dollar, end_pos - dollar, replacement);
-    pos = dollar + replacement.size();
-  }
-  return str;
+  expander_->SetShellMemoization(false);
+  result.expander = expander_;
+  result.variables = variables_;
+  return result;
 }
 
-MakefileParseResult MakefileParser::Parse()
+void MakefileParser::ParseLines(size_t begin, size_t end, MakefileParseResult& result)
 {
-  MakefileParseResult result;
+  LineCursor cursor{lines_, begin, end};
   std::string line;
-  bool first_rule = true;
-  LoadEnvVars();
 
-  while (std::getline(file_, line))
+  while (NextLogicalLine(cursor, line))
   {
-    while (line.ends_with('\\'))
+    LexedLine lexed = LexLine(line);
+    switch (lexed.kind)
     {
-      line.pop_back();
-      std::string next_line;
-      if (!std::getline(file_, next_line))
+      case LineKind::kVpath:
+        ParseVpathDirective(ExpandVariables(lexed.arguments), result.vpath);
         break;
-      line += next_line;
-    }
 
-    std::string trimmed = LTrim(line);
-
-    if (trimmed.starts_with(".PHONY:"))
-    {
-      line = ExpandVariables(line);
-      std::vector<std::string> p = ParsePhonyTargets(line);
-      result.phony_targets.insert(p.begin(), p.end());
-      continue;
-    }
+      case LineKind::kAssignment:
+        Assign(MakeAssignment(lexed), lexed.is_override ? VariableOrigin::kOverride : VariableOrigin::kFile);
+        break;
 
-    if (line[0] != '\t' && !trimmed.empty() && trimmed[0] != '#')
-    {
-      if (trimmed.find(":=") != std::string::npos)
+      case LineKind::kTargetAssignment:
       {
-        auto [name, value] = ParseImVar(trimmed);
-        if (!name.empty())
-          im_var_[name] = ExpandVariables(value);
-        continue;
-      }
-      if (trimmed.find("?=") != std::string::npos)
-      {
-        auto [name, value] = ParseConditionalVar(trimmed);
-        auto it_im = im_var_.find(name);
-        auto it_lazy = lazy_vars_.find(name);
+        VariableAssignment assignment = MakeAssignment(lexed);
+        if (assignment.op == AssignOp::kSimple)
+          assignment.value = ExpandVariables(assignment.value);
 
-        if (it_im == im_var_.end() && it_lazy == lazy_vars_.end())
-          lazy_vars_[name] = value;
-        continue;
+        std::string targets = ExpandVariables(lexed.targets);
+        for (std::string_view target : SplitWords(targets))
+        {
+          if (target.find('%') != std::string_view::npos)
+            result.pattern_vars.emplace_back(std::string(target), VariableAssignments{assignment});
+          else
+            result.target_vars[std::string(target)].push_back(assignment);
+        }
+        break;
       }
-      if (trimmed.find('=') != std::string::npos)
+
+      case LineKind::kRule:
       {
-        auto [name, value] = ParseLazyVar(trimmed);
-        if (!name.empty())
-          lazy_vars_[name] = value;
-        continue;
+        std::vector<std::string> commands = ParseCommands(cursor);
+        std::string targets = Trim(ExpandVariables(lexed.targets));
+        std::string prerequisites = ExpandVariables(lexed.prerequisites);
+
+        if (targets == ".PHONY")
+        {
+          for (std::string_view target : SplitWords(prerequisites))
+            result.phony_targets.emplace(target);
+        }
+        else if (targets == ".POOL")
+          ParsePool(prerequisites, result);
+        else if (targets == ".NOTPARALLEL")
+        {
+          std::vector<std::string_view> names = SplitWords(prerequisites);
+          if (names.empty())
+            result.not_parallel = true;
+          for (std::string_view target : names)
+            result.not_parallel_targets.emplace(target);
+        }
+        else if (targets == ".RESTAT")
+        {
+          std::vector<std::string_view> names = SplitWords(prerequisites);
+          if (names.empty())
+            result.restat_all = true;
+          for (std::string_view target : names)
+            result.restat_targets.emplace(target);
+        }
+        else if (!targets.empty())
+          AddRules(MakeRules(targets, ExpandVariables(lexed.target_pattern), prerequisites,
+                             ExpandVariables(lexed.order_only), std::move(commands), lexed.is_grouped,
+                             expander_->Directories()),
+                   result);
+        break;
       }
+
+      default:
+        break;
     }
+  }
+}
 
-    if (!line.empty() && (trimmed.empty() || trimmed[0] != '#'))
-    {
-      size_t colon_pos = line.find(':');
-      std::string target_part = (colon_pos != std::string::npos)
-        ? RTrim(line.substr(0, colon_pos)) : std::string();
+// Statements are cut apart at the lines the main loop always starts on, and
+// chunks of them are searched for literal rules on all threads. The units
+// are then replayed in file order: literal rules are added as they are, the
+// rest goes through ParseLines, so assignments and expansions see exactly
+// the variables they would see in a sequential parse.
+void MakefileParser::ParseChunked(size_t threads, MakefileParseResult& result)
+{
+  std::vector<ParsedUnit> units;
+  size_t begin = 0;
+  for (size_t i = 1; i <= lines_.size(); ++i)
+  {
+    if (i < lines_.size() && !IsStatementStart(lines_, i)) continue;
+    units.push_back(ParsedUnit{begin, i, std::nullopt});
+    begin = i;
+  }
 
-      if (!target_part.empty())
-      {
-        line = ExpandVariables(line);
-        colon_pos = line.find(':');
-        target_part = (colon_pos != std::string::npos)
-          ? RTrim(line.substr(0, colon_pos)) : std::string();
-      }
+  size_t chunk_count = std::min(units.size(), threads * 4);
+  std::vector<std::exception_ptr> errors(chunk_count);
+  std::atomic<size_t> next_chunk = 0;
+  DirectoryCache& dirs = expander_->Directories();
 
-      if (!target_part.empty() && target_part.find('%') != std::string::npos)
+  auto worker = [&]() {
+    for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++)
+    {
+      size_t first = units.size() * chunk / chunk_count;
+      size_t last = units.size() * (chunk + 1) / chunk_count;
+      try
       {
-        PatternRule pattern_rule = ParsePatternRule(line, file_);
-        if (!pattern_rule.target_pattern.empty())
-          result.pattern_rules.push_back(pattern_rule);
+        for (size_t i = first; i < last; ++i)
+          ParseLiteralRule(lines_, dirs, units[i]);
       }
-      else if (!target_part.empty())
+      catch (...)
       {
-        Rule rule = ParseRule(line, file_);
-        if (!rule.GetTarget().empty())
-        {
-          std::string target_str = rule.GetTarget().string();
-          result.rules[target_str] = rule;
-          if (first_rule)
-          {
-            result.default_target = target_str;
-            first_rule = false;
-          }
-        }
+        errors[chunk] = std::current_exception();
       }
     }
-  }
+  };
 
-  result.vars = im_var_;
-  for (const auto& [k, v] : lazy_vars_)
-    result.vars[k] = v;
-  return result;
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(threads, chunk_count); ++i)
+    workers.emplace_back(worker);
+  worker();
+  for (std::thread& thread : workers)
+    thread.join();
+
+  for (const std::exception_ptr& error : errors)
+    if (error) std::rethrow_exception(error);
+
+  for (ParsedUnit& unit : units)
+  {
+    if (unit.header)
+      AddRules(std::move(*unit.header), result);
+    else
+      ParseLines(unit.begin, unit.end, result);
+  }
 }
 
-void MakefileParser::LoadEnvVars()
+void MakefileParser::AddRules(RuleHeader header, MakefileParseResult& result)
 {
-#ifdef _WIN32
-  LPCH env_block = GetEnvironmentStringsA();
-  if (env_block == nullptr) return;
+  for (const std::string& warning : header.warnings)
+    loging::LogError(warning);
+
+  for (Rule& rule : header.rules)
+  {
+    std::string target = rule.GetTarget().string();
+    if (result.default_target.empty())
+      result.default_target = target;
+    result.rules[target] = std::move(rule);
+  }
+  for (PatternRule& pattern_rule : header.pattern_rules)
+    result.pattern_rules.push_back(std::move(pattern_rule));
+}
 
-  for (LPTSTR env_var = env_block; *env_var; env_var += strlen(env_var) + 1)
+void MakefileParser::Assign(const VariableAssignment& assignment, VariableOrigin origin)
+{
+  const Variable* existing = variables_->Find(assignment.name);
+  switch (assignment.op)
   {
-    std::string entry(env_var);
-    size_t eq_pos = entry.find('=');
-    if (eq_pos != std::string::npos)
+    case AssignOp::kRecursive:
+      variables_->Set(assignment.name, assignment.value, true, origin);
+      break;
+
+    case AssignOp::kSimple:
+      variables_->Set(assignment.name, ExpandVariables(assignment.value), false, origin);
+      break;
+
+    case AssignOp::kConditional:
+      if (!existing)
+        variables_->Set(assignment.name, assignment.value, true, origin);
+      break;
+
+    case AssignOp::kAppend:
     {
-      std::string key = entry.substr(0, eq_pos);
-      std::string value = entry.substr(eq_pos + 1);
-      lazy_vars_.insert({key, value});
+      if (!existing)
+      {
+        variables_->Set(assignment.name, assignment.value, true, origin);
+        break;
+      }
+      if (existing->origin > origin)
+        break;
+      // the appended text is expanded now when the variable is simple
+      std::string value = existing->value;
+      std::string text = existing->recursive ? assignment.value : ExpandVariables(assignment.value);
+      if (!value.empty() && !text.empty())
+        value += ' ';
+      value += text;
+      variables_->Set(assignment.name, std::move(value), existing->recursive, origin);
+      break;
     }
   }
+}
+
 
-  FreeEnvironmentStringsA(env_block);
-#else
-  if (environ == nullptr) return;
+std::vector<std::string> CompareParseResults(const MakefileParseResult& expected, const MakefileParseResult& actual)
+{
+  std::vector<std::string> differences;
 
-  for (char **env = environ; *env != nullptr; ++env)
+  for (const auto& [target, rule] : expected.rules)
   {
-    std::string entry(*env);
-    size_t eq_pos = entry.find('=');
-    if (eq_pos != std::string::npos)
-    {
-      std::string key = entry.substr(0, eq_pos);
-      std::string value = entry.substr(eq_pos + 1);
-      lazy_vars_.insert({key, value});
-    }
+    auto it = actual.rules.find(target);
+    if (it == actual.rules.end())
+      differences.push_back("rule '" + target + "' is missing");
+    else if (!(it->second == rule))
+      differences.push_back("rule '" + target + "' differs");
   }
-#endif
-}
\ No newline at end of file
+  for (const auto& [target, rule] : actual.rules)
+    if (!expected.rules.contains(target))
+      differences.push_back("rule '" + target + "' is unexpected");
+
+  if (expected.pattern_rules != actual.pattern_rules)
+    differences.push_back("pattern rules differ");
+  if (expected.phony_targets != actual.phony_targets)
+    differences.push_back(".PHONY targets differ");
+  if (expected.pools != actual.pools)
+    differences.push_back(".POOL definitions differ");
+  if (expected.not_parallel != actual.not_parallel || expected.not_parallel_targets != actual.not_parallel_targets)
+    differences.push_back(".NOTPARALLEL differs");
+  if (expected.restat_all != actual.restat_all || expected.restat_targets != actual.restat_targets)
+    differences.push_back(".RESTAT differs");
+  if (expected.default_target != actual.default_target)
+    differences.push_back("default target '" + actual.default_target + "' should be '" + expected.default_target + "'");
+
+  std::vector<std::pair<std::string, Variable>> expected_vars = expected.variables->Entries();
+  std::vector<std::pair<std::string, Variable>> actual_vars = actual.variables->Entries();
+  for (const auto& [name, var] : expected_vars)
+  {
+    auto it = std::lower_bound(actual_vars.begin(), actual_vars.end(), name,
+                               [](const auto& entry, const std::string& key) { return entry.first < key; });
+    if (it == actual_vars.end() || it->first != name)
+      differences.push_back("variable '" + name + "' is missing");
+    else if (!(it->second == var))
+      differences.push_back("variable '" + name + "' is '" + it->second.value + "', should be '" + var.value + "'");
+  }
+  if (actual_vars.size() > expected_vars.size())
+    differences.push_back("there are unexpected variables");
+
+  if (!(expected.vpath == actual.vpath))
+    differences.push_back("vpath search differs");
+  if (expected.target_vars != actual.target_vars)
+    differences.push_back("target-specific variables differ");
+  if (expected.pattern_vars != actual.pattern_vars)
+    differences.push_back("pattern-specific variables differ");
+
+  return differences;
+}
@@ -1,38 +1,75 @@
 #pragma once
 
-#include <fstream>
-#include <set>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "rule.h"
 #include "pattern_rule.h"
+#include "expander.h"
+#include "vpath.h"
+#include "target_vars.h"
+#include "variables.h"
 
 struct MakefileParseResult
 {
 	std::unordered_map<std::string, Rule> rules;
 	std::vector<PatternRule> pattern_rules;
 	std::unordered_set<std::string> phony_targets;
+	// .POOL: name depth
+	std::unordered_map<std::string, size_t> pools;
+	// .NOTPARALLEL: without prerequisites, and the targets it names
+	bool not_parallel = false;
+	std::unordered_set<std::string> not_parallel_targets;
+	// .RESTAT: without prerequisites, and the targets it names
+	bool restat_all = false;
+	std::unordered_set<std::string> restat_targets;
 	std::string default_target;
 
-	std::unordered_map<std::string, std::string> vars;
+	std::shared_ptr<VariableTable> variables;
+	VpathSearch vpath;
+
+	// target-specific assignments by target, pattern-specific ones in file order
+	std::unordered_map<std::string, VariableAssignments> target_vars;
+	std::vector<std::pair<std::string, VariableAssignments>> pattern_vars;
+	std::shared_ptr<Expander> expander;
 };
 
+struct RuleHeader;
+
 class MakefileParser
 {
 public:
-	explicit MakefileParser(const std::string& filename);
+	// cli_assignments are NAME=value arguments given on the command line;
+	// filename and the files the Makefile names are relative to the base of
+	// directories
+	MakefileParser(const std::string& filename, const std::vector<std::string>& cli_assignments = {},
+	               DirectoryCache directories = DirectoryCache());
 
-	MakefileParseResult Parse();
+	// threads == 1 reads the file line by line. With more, the file is cut
+	// into chunks at rule boundaries whose rules are read in parallel; the
+	// result is the same. 0 picks by file size and hardware_concurrency.
+	MakefileParseResult Parse(size_t threads = 0);
 
 private:
-	std::ifstream file_;
+	std::string text_;
+	// the physical lines of text_, split like std::getline does
+	std::vector<std::string_view> lines_;
 
-	std::string ExpandVariables(std::string str, std::set<std::string>* in_progress = nullptr);
-	void LoadEnvVars();
+	std::shared_ptr<Expander> expander_;
+	std::shared_ptr<VariableTable> variables_;
 
-	std::unordered_map<std::string, std::string> lazy_vars_;
-	std::unordered_map<std::string, std::string> im_var_;
+	std::string ExpandVariables(std::string_view str);
+	void Assign(const VariableAssignment& assignment, VariableOrigin origin);
+
+	void ParseLines(size_t begin, size_t end, MakefileParseResult& result);
+	void ParseChunked(size_t threads, MakefileParseResult& result);
+	void AddRules(RuleHeader header, MakefileParseResult& result);
 };
+
+// Differences between two parses of the same Makefile, one line each;
+// empty when they agree.
+std::vector<std::string> CompareParseResults(const MakefileParseResult& expected, const MakefileParseResult& actual);
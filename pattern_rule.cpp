@@ -0,0 +1,30 @@
+#include "pattern_rule.h"
+
+std::optional<std::string> MatchPattern(const std::string& pattern, const std::string& target)
+{
+  size_t pct = pattern.find('%');
+  if (pct == std::string::npos) return std::nullopt;
+
+  std::string_view prefix = std::string_view(pattern).substr(0, pct);
+  std::string_view suffix = std::string_view(pattern).substr(pct + 1);
+
+  if (target.size() < prefix.size() + suffix.size()) return std::nullopt;
+  if (!target.starts_with(prefix) || !target.ends_with(suffix)) return std::nullopt;
+
+  size_t stem_len = target.size() - prefix.size() - suffix.size();
+  return target.substr(prefix.size(), stem_len);
+}
+
+std::string SubstituteStem(const std::string& text, const std::string& stem)
+{
+  // like GNU make, only the first % stands for the stem
+  size_t pct = text.find('%');
+  if (pct == std::string::npos) return text;
+
+  std::string result;
+  result.reserve(text.size() + stem.size());
+  result.append(text, 0, pct);
+  result += stem;
+  result.append(text, pct + 1, std::string::npos);
+  return result;
+}
@@ -1,7 +1,9 @@
 #pragma once
 
-#include <vector>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 struct PatternRule
 {
@@ -15,9 +17,16 @@ struct PatternRule
              std::vector<std::string> deps,
              std::vector<std::string> order_only_deps,
              std::vector<std::string> commands)
-    : target_pattern(target_pattern)
-    , deps(deps)
-    , order_only_deps(order_only_deps)
-    , commands(commands)
+    : target_pattern(std::move(target_pattern))
+    , deps(std::move(deps))
+    , order_only_deps(std::move(order_only_deps))
+    , commands(std::move(commands))
   {}
-};
\ No newline at end of file
+
+  bool operator==(const PatternRule&) const = default;
+};
+
+// the part of target matched by the '%' of pattern
+std::optional<std::string> MatchPattern(const std::string& pattern, const std::string& target);
+// text with its first '%' replaced by stem
+std::string SubstituteStem(const std::string& text, const std::string& stem);
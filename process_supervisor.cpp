@@ -0,0 +1,374 @@
+#include "process_supervisor.h"
+
+#include "logger.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+struct ProcessSupervisor::Child
+{
+  uint64_t id = 0;
+  int pid = -1;
+  int pidfd = -1;
+  int out_fd = -1;
+  int err_fd = -1;
+  std::string out_line;
+  std::string err_line;
+  Completion done;
+};
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+
+namespace
+{
+  int signal_pipe[2] = {-1, -1};
+
+  // epoll data of a descriptor: the child number times 4 plus its kind,
+  // 0 for the signal pipe
+  enum WatchKind : uint64_t
+  {
+    kWatchPidfd = 1,
+    kWatchOut = 2,
+    kWatchErr = 3,
+  };
+  constexpr uint64_t kWatchSignal = 0;
+
+  void OnSignal(int signal)
+  {
+    int saved_errno = errno;
+    unsigned char byte = static_cast<unsigned char>(signal);
+    [[maybe_unused]] ssize_t written = write(signal_pipe[1], &byte, 1);
+    errno = saved_errno;
+  }
+
+  int PidfdOpen(int pid)
+  {
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+  }
+
+  // complete lines go out under the log mutex, so output of children that
+  // run at the same time is never mixed within a line
+  void Forward(std::string& line, const char* data, size_t size, bool to_stderr, bool final)
+  {
+    line.append(data, size);
+    size_t end = line.size();
+    if (!final)
+    {
+      size_t newline = line.rfind('\n');
+      if (newline == std::string::npos) return;
+      end = newline + 1;
+    }
+    if (end == 0) return;
+
+    std::ostream& stream = to_stderr ? std::cerr : std::cout;
+    {
+      std::lock_guard<std::mutex> lock(loging::LogMutex());
+      stream.write(line.data(), static_cast<std::streamsize>(end));
+      stream.flush();
+    }
+    line.erase(0, end);
+  }
+}
+
+ProcessSupervisor* ProcessSupervisor::Instance()
+{
+  static ProcessSupervisor* instance = []() -> ProcessSupervisor* {
+    // kernels before 5.3 have no pidfd_open
+    int probe = PidfdOpen(getpid());
+    if (probe < 0) return nullptr;
+    close(probe);
+
+    auto* supervisor = new ProcessSupervisor();
+    if (!supervisor->Start())
+    {
+      delete supervisor;
+      return nullptr;
+    }
+    return supervisor;
+  }();
+  return instance;
+}
+
+bool ProcessSupervisor::Start()
+{
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) return false;
+
+  if (pipe2(signal_pipe, O_CLOEXEC | O_NONBLOCK) != 0) return false;
+  signal_fd_ = signal_pipe[0];
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = kWatchSignal;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, &event);
+
+  // signals make was started ignoring stay ignored, for it and the children
+  struct sigaction action{};
+  action.sa_handler = OnSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  for (int signal : {SIGINT, SIGTERM, SIGHUP})
+  {
+    struct sigaction previous{};
+    if (sigaction(signal, nullptr, &previous) == 0 && previous.sa_handler != SIG_IGN)
+      sigaction(signal, &action, nullptr);
+  }
+
+  // every child holds three descriptors
+  rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  // lives until the process exits
+  thread_ = std::thread(&ProcessSupervisor::Loop, this);
+  thread_.detach();
+  return true;
+}
+
+void ProcessSupervisor::Spawn(const std::string& command, Completion done)
+{
+  int out_pipe[2];
+  int err_pipe[2];
+  if (pipe2(out_pipe, O_CLOEXEC) != 0)
+  {
+    done(127 << 8);
+    return;
+  }
+  if (pipe2(err_pipe, O_CLOEXEC) != 0)
+  {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    done(127 << 8);
+    return;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+
+  const char* argv[] = {"/bin/sh", "-c", command.c_str(), nullptr};
+  pid_t pid;
+  int error = posix_spawn(&pid, "/bin/sh", &actions, &attr, const_cast<char* const*>(argv), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+
+  if (error != 0)
+  {
+    close(out_pipe[0]);
+    close(err_pipe[0]);
+    done(127 << 8);
+    return;
+  }
+
+  auto child = std::make_shared<Child>();
+  child->pid = pid;
+  child->pidfd = PidfdOpen(pid);
+  child->out_fd = out_pipe[0];
+  child->err_fd = err_pipe[0];
+  child->done = std::move(done);
+  fcntl(child->out_fd, F_SETFL, O_NONBLOCK);
+  fcntl(child->err_fd, F_SETFL, O_NONBLOCK);
+
+  if (child->pidfd < 0)
+  {
+    // out of descriptors: wait for this one in place
+    WaitInPlace(child);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (interrupt_signal_ != 0)
+    kill(-pid, interrupt_signal_);
+  child->id = next_child_++;
+  children_[child->id] = child;
+  const std::pair<int, WatchKind> watches[] = {
+    {child->pidfd, kWatchPidfd}, {child->out_fd, kWatchOut}, {child->err_fd, kWatchErr}};
+  for (auto [fd, kind] : watches)
+  {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = child->id * 4 + kind;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+bool ProcessSupervisor::Drain(Child& child, int fd, bool final)
+{
+  bool to_stderr = fd == child.err_fd;
+  std::string& line = to_stderr ? child.err_line : child.out_line;
+
+  char buffer[1 << 16];
+  bool eof = false;
+  while (true)
+  {
+    ssize_t got = read(fd, buffer, sizeof(buffer));
+    if (got > 0)
+    {
+      Forward(line, buffer, static_cast<size_t>(got), to_stderr, false);
+      continue;
+    }
+    if (got < 0 && errno == EINTR) continue;
+    eof = got == 0;
+    break;
+  }
+  if (final)
+    Forward(line, nullptr, 0, to_stderr, true);
+  return eof;
+}
+
+bool ProcessSupervisor::Reap(const std::shared_ptr<Child>& child)
+{
+  int status = 0;
+  pid_t reaped;
+  while ((reaped = waitpid(child->pid, &status, WNOHANG)) < 0 && errno == EINTR) {}
+  if (reaped == 0)
+    return false;
+
+  // whatever the child wrote before it exited is still in the pipes;
+  // descendants that keep them open don't hold up the completion
+  Drain(*child, child->out_fd, true);
+  Drain(*child, child->err_fd, true);
+
+  int interrupt_signal = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int fd : {child->pidfd, child->out_fd, child->err_fd})
+    {
+      if (fd < 0) continue;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+      close(fd);
+    }
+    children_.erase(child->id);
+    if (children_.empty())
+      interrupt_signal = interrupt_signal_;
+  }
+
+  // the last interrupted child is gone, die of the signal like the children
+  // before anyone gets to treat the failure as an ordinary one
+  if (interrupt_signal != 0)
+  {
+    signal(interrupt_signal, SIG_DFL);
+    raise(interrupt_signal);
+  }
+
+  child->done(status);
+  return true;
+}
+
+// Without a pidfd the child is polled for, and its pipes are drained in
+// the meantime, or a child that writes more than a pipe holds never exits.
+void ProcessSupervisor::WaitInPlace(const std::shared_ptr<Child>& child)
+{
+  pollfd pipes[2] = {{child->out_fd, POLLIN, 0}, {child->err_fd, POLLIN, 0}};
+  while (!Reap(child))
+  {
+    if (poll(pipes, 2, 10) <= 0) continue;
+    for (pollfd& watched : pipes)
+      if (watched.revents != 0 && Drain(*child, watched.fd, false))
+        watched.fd = -1;
+  }
+}
+
+void ProcessSupervisor::Interrupt(int signal)
+{
+  bool idle;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    interrupt_signal_ = signal;
+    for (const auto& [id, child] : children_)
+      kill(-child->pid, signal);
+    idle = children_.empty();
+  }
+  if (idle)
+  {
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+  }
+}
+
+void ProcessSupervisor::Loop()
+{
+  epoll_event events[64];
+  while (true)
+  {
+    int count = epoll_wait(epoll_fd_, events, 64, -1);
+    if (count < 0)
+    {
+      if (errno == EINTR) continue;
+      return;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+      uint64_t watch = events[i].data.u64;
+      if (watch == kWatchSignal)
+      {
+        unsigned char byte;
+        while (read(signal_fd_, &byte, 1) == 1)
+          Interrupt(byte);
+        continue;
+      }
+
+      // an event of a child reaped earlier in the batch finds nothing
+      std::shared_ptr<Child> child;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = children_.find(watch / 4);
+        if (it == children_.end()) continue;
+        child = it->second;
+      }
+
+      uint64_t kind = watch % 4;
+      if (kind == kWatchPidfd)
+      {
+        Reap(child);
+        continue;
+      }
+
+      int fd = kind == kWatchOut ? child->out_fd : child->err_fd;
+      // a closed pipe stays readable, it is only watched until then
+      if (Drain(*child, fd, false) || !(events[i].events & EPOLLIN))
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+      }
+    }
+  }
+}
+
+#else
+
+ProcessSupervisor* ProcessSupervisor::Instance()
+{
+  return nullptr;
+}
+
+void ProcessSupervisor::Spawn(const std::string&, Completion done)
+{
+  done(-1);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Runs shell commands without a thread per child: one epoll loop watches
+// the pidfd and the stdout/stderr pipes of every child, forwards output a
+// line at a time and calls the completion with the wait status once the
+// child exited. Children get their own process group, and SIGINT, SIGTERM
+// and SIGHUP are forwarded to all of them before make dies of the signal.
+class ProcessSupervisor
+{
+public:
+  using Completion = std::function<void(int status)>;
+
+  // nullptr where pidfd or epoll are not available
+  static ProcessSupervisor* Instance();
+
+  // done is called on the supervisor thread, or right away if the command
+  // cannot be started
+  void Spawn(const std::string& command, Completion done);
+
+private:
+  struct Child;
+
+  int epoll_fd_ = -1;
+  int signal_fd_ = -1;
+  std::mutex mutex_;
+  // by a number never reused, which epoll events carry instead of the
+  // descriptors: those are reused as soon as a child is reaped
+  std::unordered_map<uint64_t, std::shared_ptr<Child>> children_;
+  uint64_t next_child_ = 1;
+  int interrupt_signal_ = 0;
+  std::thread thread_;
+
+  ProcessSupervisor() = default;
+  bool Start();
+  void Loop();
+  // returns true at end of file
+  bool Drain(Child& child, int fd, bool final);
+  // false while the child is still running
+  bool Reap(const std::shared_ptr<Child>& child);
+  void WaitInPlace(const std::shared_ptr<Child>& child);
+  void Interrupt(int signal);
+};
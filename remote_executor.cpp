@@ -0,0 +1,119 @@
+#include "remote_executor.h"
+
+#include <filesystem>
+#include <iostream>
+#include <utility>
+
+#include "wire_protocol.h"
+#include "logger.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+#ifndef _WIN32
+  int ConnectToWorker(const std::string& socket_path)
+  {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path))
+      return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    addr.sun_family = AF_UNIX;
+    socket_path.copy(addr.sun_path, socket_path.size());
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  bool SendRequest(int fd, const CommandRequest& request)
+  {
+    using wire::FrameType;
+
+    if (!wire::WriteFrame(fd, FrameType::kCommand, request.command)) return false;
+    if (!wire::WriteFrame(fd, FrameType::kDirectory, (fs::current_path() / request.directory).string())) return false;
+
+    for (char **env = environ; env && *env; ++env)
+      if (!wire::WriteFrame(fd, FrameType::kEnv, *env)) return false;
+
+    for (const std::string& input : request.inputs)
+    {
+      // named as the command sees it
+      std::optional<wire::FileBlob> blob = wire::LoadFile(fs::path(request.directory) / input);
+      if (blob) blob->path = input;
+      if (blob && !wire::WriteFrame(fd, FrameType::kInput, wire::PackFile(*blob))) return false;
+    }
+
+    for (const std::string& output : request.outputs)
+      if (!wire::WriteFrame(fd, FrameType::kOutput, output)) return false;
+
+    return wire::WriteFrame(fd, FrameType::kEnd, "");
+  }
+#endif
+}
+
+RemoteExecutor::RemoteExecutor(std::string socket_path)
+  : socket_path_(std::move(socket_path))
+{}
+
+int RemoteExecutor::Execute(const CommandRequest& request)
+{
+#ifdef _WIN32
+  (void)request;
+  throw loging::MakeException("Remote execution is not supported on this platform");
+#else
+  int fd = ConnectToWorker(socket_path_);
+  if (fd < 0)
+    throw loging::MakeException("Cannot connect to worker '" + socket_path_ + "'");
+
+  if (!SendRequest(fd, request))
+  {
+    close(fd);
+    throw loging::MakeException("Cannot send command to worker '" + socket_path_ + "'");
+  }
+
+  int status = -1;
+  while (std::optional<wire::Frame> frame = wire::ReadFrame(fd))
+  {
+    if (frame->type == wire::FrameType::kStdout)
+    {
+      std::lock_guard<std::mutex> lock(loging::LogMutex());
+      std::cout.write(frame->payload.data(), frame->payload.size()).flush();
+    }
+    else if (frame->type == wire::FrameType::kStderr)
+    {
+      std::lock_guard<std::mutex> lock(loging::LogMutex());
+      std::cerr.write(frame->payload.data(), frame->payload.size()).flush();
+    }
+    else if (frame->type == wire::FrameType::kFile)
+    {
+      std::optional<wire::FileBlob> blob = wire::UnpackFile(frame->payload);
+      if (!blob || !wire::StoreFile(fs::path(request.directory) / blob->path, *blob))
+        loging::LogError("Cannot store output received from worker");
+    }
+    else if (frame->type == wire::FrameType::kExit)
+    {
+      status = std::stoi(frame->payload);
+      break;
+    }
+  }
+  close(fd);
+
+  if (status < 0)
+    throw loging::MakeException("Lost connection to worker '" + socket_path_ + "'");
+  return status;
+#endif
+}
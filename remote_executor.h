@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+#include "executor.h"
+
+// Ships every command with its environment and declared inputs to a worker
+// daemon (see worker.h) and streams its output and produced files back.
+class RemoteExecutor : public Executor
+{
+  std::string socket_path_;
+
+public:
+  explicit RemoteExecutor(std::string socket_path);
+
+  int Execute(const CommandRequest& request) override;
+};
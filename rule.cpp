@@ -1,210 +1,338 @@
 #include <cstdlib>
-#include <set>
+#include <future>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "rule.h"
+#include "pattern_rule.h"
 #include "options.h"
+#include "executor.h"
+#include "artifact_cache.h"
+#include "expander.h"
+#include "variables.h"
 #include "logger.h"
 
 namespace
 {
-  static const std::unordered_set<std::string> kSpecialVars = {"@F", "@D", "<F", "<D", "^F", "^D"};
-
-  bool FindVariable(const std::string& str, size_t pos,
-    size_t* dollar, std::string* var_name, size_t* end)
+  // Automatic variables of one recipe ($@, $<, $^, $(@D)...) on top of the
+  // target-specific and then the Makefile variables. Values are computed
+  // when first referenced.
+  class RecipeScope : public VariableScope
   {
-    while (pos < str.size())
-    {
-      size_t dollar_pos = str.find('$', pos);
-      if (dollar_pos == std::string::npos || dollar_pos + 1 >= str.size())
-        return false;
+    const fs::path& target_;
+    const std::vector<fs::path>& dependencies_;
+    const std::vector<fs::path>& order_only_;
+    const std::string& stem_;
+    const DirectoryCache& dirs_;
+    LayeredScope vars_;
+    std::unordered_map<std::string, std::string> automatic_;
 
-      size_t var_start = 0;
-      size_t var_end = 0;
+    std::string NewerDependencies() const
+    {
+      std::string new_deps;
+      std::error_code ec;
+      fs::path target = dirs_.Resolve(target_.string());
+      bool target_exists = fs::exists(target, ec);
+      fs::file_time_type target_time;
+      if (target_exists)
+        target_time = fs::last_write_time(target, ec);
 
-      if (str[dollar_pos + 1] == '(')
-      {
-        var_start = dollar_pos + 2;
-        var_end = str.find(')', var_start);
-      }
-      else if (str[dollar_pos + 1] == '{')
-      {
-        var_start = dollar_pos + 2;
-        var_end = str.find('}', var_start);
-      }
-      else
+      for (const fs::path& dep : dependencies_)
       {
-        pos = dollar_pos + 1;
-        continue;
+        fs::path path = dirs_.Resolve(dep.string());
+        if (!target_exists || (fs::exists(path, ec) && target_time < fs::last_write_time(path, ec)))
+          new_deps += (new_deps.empty() ? "" : " ") + dep.string();
       }
+      return new_deps;
+    }
 
-      if (var_end == std::string::npos)
-      {
-        pos = dollar_pos + 1;
-        continue;
-      }
+    std::optional<std::string> ComputeWords(char name) const
+    {
+      std::string words;
+      auto append = [&words](const fs::path& path) {
+        words += (words.empty() ? "" : " ") + path.string();
+      };
 
-      *var_name = str.substr(var_start, var_end - var_start);
-      if (kSpecialVars.count(*var_name))
+      switch (name)
       {
-        pos = dollar_pos + 1;
-        continue;
+        case '@': return target_.string();
+        case '*': return stem_;
+        case '<': return dependencies_.empty() ? "" : dependencies_[0].string();
+        case '?': return NewerDependencies();
+        case '+':
+          for (const fs::path& dep : dependencies_) append(dep);
+          return words;
+        case '^':
+        {
+          std::unordered_set<std::string> seen;
+          for (const fs::path& dep : dependencies_)
+            if (seen.insert(dep.string()).second) append(dep);
+          return words;
+        }
+        case '|':
+          for (const fs::path& dep : order_only_) append(dep);
+          return words;
+        default:
+          return std::nullopt;
       }
-
-      *dollar = dollar_pos;
-      *end = var_end + 1;
-      return true;
     }
-    return false;
-  }
 
-  std::string ExpandVariables(std::string str,
-    const std::unordered_map<std::string, std::string>& vars,
-    std::set<std::string>* in_progress = nullptr)
-  {
-    std::set<std::string> local;
-    std::set<std::string>* ip = in_progress ? in_progress : &local;
+    std::optional<std::string> Compute(std::string_view name) const
+    {
+      if (name.size() == 1)
+        return ComputeWords(name[0]);
+      if (name.size() != 2 || (name[1] != 'D' && name[1] != 'F'))
+        return std::nullopt;
 
-    size_t pos = 0;
-    size_t dollar, end_pos;
-    std::string var_name;
+      std::optional<std::string> words = ComputeWords(name[0]);
+      if (!words) return std::nullopt;
 
-    while (FindVariable(str, pos, &dollar, &var_name, &end_pos))
-    {
-      std::string replacement;
-      if (ip->count(var_name))
-        replacement = "";
-      else
+      // $(@D) and $(@F) are the directory and file parts of every word
+      std::string result;
+      std::istringstream iss(*words);
+      std::string word;
+      while (iss >> word)
       {
-        ip->insert(var_name);
-        auto it = vars.find(var_name);
-        if (it != vars.end())
-          replacement = ExpandVariables(it->second, vars, ip);
+        size_t slash = word.rfind('/');
+        if (!result.empty()) result += ' ';
+        if (name[1] == 'F')
+          result += slash == std::string::npos ? word : word.substr(slash + 1);
         else
-          replacement = "";
-        ip->erase(var_name);
+          result += slash == std::string::npos ? "." : (slash == 0 ? "/" : word.substr(0, slash));
       }
+      return result;
+    }
+
+  public:
+    RecipeScope(const fs::path& target, const std::vector<fs::path>& dependencies,
+                const std::vector<fs::path>& order_only, const std::string& stem, const DirectoryCache& dirs,
+                const VariableLayer* layer, VariableScope& globals)
+      : target_(target)
+      , dependencies_(dependencies)
+      , order_only_(order_only)
+      , stem_(stem)
+      , dirs_(dirs)
+      , vars_(layer, globals)
+    {}
+
+    std::optional<VariableRef> Lookup(std::string_view name) override
+    {
+      if (name.size() <= 2)
+      {
+        auto it = automatic_.find(std::string(name));
+        if (it != automatic_.end())
+          return VariableRef{it->second, false};
 
-      str.replace(dollar, end_pos - dollar, replacement);
-      pos = dollar + replacement.size();
+        std::optional<std::string> value = Compute(name);
+        if (value)
+        {
+          auto inserted = automatic_.emplace(std::string(name), std::move(*value)).first;
+          return VariableRef{inserted->second, false};
+        }
+      }
+      return vars_.Lookup(name);
     }
-    return str;
+  };
+
+  // paths the cache can open, which are relative to the base of dirs
+  std::vector<fs::path> ResolveAll(const DirectoryCache& dirs, const std::vector<fs::path>& paths)
+  {
+    if (dirs.Base().empty()) return paths;
+    std::vector<fs::path> resolved;
+    resolved.reserve(paths.size());
+    for (const fs::path& path : paths)
+      resolved.emplace_back(dirs.Resolve(path.string()));
+    return resolved;
   }
 }
 
 bool Rule::IsNeedRebuild(const MakeOptions& options) const
 {
-	if (options.always_make) return true;
+	return OutOfDateReason(options).has_value();
+}
 
-	if (!fs::exists(target_)) return true;
+std::optional<std::string> Rule::OutOfDateReason(const MakeOptions& options) const
+{
+	if (options.always_make) return "--always-make is set";
 
-	if (is_phony_) return true;
+	// missing files are answered from cached directory listings, only
+	// existing ones cost a stat
+	DirectoryCache& dirs = (options.expander ? *options.expander : DefaultExpander()).Directories();
 
-	auto target_time = fs::last_write_time(target_);
+	// a group is as old as its oldest member
+	std::optional<fs::file_time_type> target_time;
+	for (const fs::path& output : GetOutputs())
+	{
+		if (!dirs.Exists(output.string())) return "it does not exist";
+		fs::file_time_type output_time = fs::last_write_time(dirs.Resolve(output.string()));
+		if (!target_time || output_time < *target_time)
+			target_time = output_time;
+	}
+
+	if (is_phony_) return "it is phony";
+
+	std::vector<fs::path> scratch;
+	for (const fs::path& dependence : GetDependencies(scratch))
+	{
+		if (!dirs.Exists(dependence.string()))
+			return "'" + dependence.string() + "' does not exist";
+		if (*target_time < fs::last_write_time(dirs.Resolve(dependence.string())))
+			return "'" + dependence.string() + "' is newer";
+	}
+	return std::nullopt;
+}
 
-	for (const fs::path& dependence : dependencies_)
-		if (!fs::exists(dependence) || target_time < fs::last_write_time(dependence))
-			return true;
-	return false;
+// One recipe in flight: its commands run one after the other, each started
+// from the completion of the previous one.
+struct RecipeRun
+{
+	MakeOptions options;
+	CommandRequest request;
+	std::vector<std::string> commands;
+	size_t next = 0;
+	bool failed = false;
+	std::optional<std::string> cache_key;
+	std::function<void(std::exception_ptr)> done;
+};
+
+void Rule::InvalidateTargetDirectory(const MakeOptions& options) const
+{
+	// the listing of the target's directory is stale once the recipe ran
+	if (options.dry_run) return;
+	DirectoryCache& dirs = (options.expander ? *options.expander : DefaultExpander()).Directories();
+	for (const fs::path& output : GetOutputs())
+		dirs.Invalidate(output.has_parent_path() ? output.parent_path().string() : ".");
 }
 
 bool Rule::Run(const MakeOptions& options)
 {
-	for (const std::string& com : commands_)
+	std::promise<void> finished;
+	RunAsync(options, [&finished](std::exception_ptr error) {
+		if (error)
+			finished.set_exception(error);
+		else
+			finished.set_value();
+	});
+	finished.get_future().get();
+	return true;
+}
+
+void Rule::RunAsync(const MakeOptions& options, std::function<void(std::exception_ptr)> done)
+{
+	std::vector<fs::path> dependency_scratch;
+	std::vector<fs::path> order_only_scratch;
+	const std::vector<fs::path>& dependencies = GetDependencies(dependency_scratch);
+	const std::vector<fs::path>& order_only = GetOrderOnlyPrerequisites(order_only_scratch);
+
+	auto run = std::make_shared<RecipeRun>();
+	run->options = options;
+	run->done = std::move(done);
+
+	DirectoryCache& dirs = (options.expander ? *options.expander : DefaultExpander()).Directories();
+	run->request.directory = dirs.Base();
+	for (const fs::path& dependence : dependencies)
+		run->request.inputs.push_back(dependence.string());
+	for (const fs::path& output : GetOutputs())
+		run->request.outputs.push_back(output.string());
+
+	run->commands = ExpandCommands(options, dependencies, order_only);
+
+	if (options.cache && !options.dry_run && !is_phony_ && !run->commands.empty())
+	{
+		std::vector<fs::path> outputs = ResolveAll(dirs, GetOutputs());
+		run->cache_key = options.cache->ComputeKey(run->commands, ResolveAll(dirs, dependencies));
+		if (run->cache_key && options.cache->Restore(*run->cache_key, outputs))
+		{
+			InvalidateTargetDirectory(options);
+			if (!options.silent)
+				loging::LogInfo("Restored '" + target_.string() + "' from cache");
+			run->done(nullptr);
+			return;
+		}
+		options.cache->DetachOutputs(outputs);
+	}
+
+	RunCommands(run);
+}
+
+void Rule::RunCommands(const std::shared_ptr<RecipeRun>& run)
+{
+	const MakeOptions& options = run->options;
+	Executor& executor = options.executor ? *options.executor : DefaultExecutor();
+
+	while (run->next < run->commands.size())
 	{
-		std::string command = PrepareCommand(com, options);
+		const std::string& command = run->commands[run->next++];
 		if (!options.silent || options.dry_run)
 			loging::LogInfo(command);
-		
+
 		if (options.dry_run)
 			continue;
-		
-		int status = system(command.c_str());
-		
-		if (status != 0)
-		{
-			std::string error_msg = "Command failed: " + command;
-			if (options.ignore_errors)
+
+		run->request.command = command;
+		executor.ExecuteAsync(run->request, [this, run](int status) {
+			if (status != 0)
 			{
+				std::string error_msg = "Command failed: " + run->request.command;
+				if (!run->options.ignore_errors)
+				{
+					InvalidateTargetDirectory(run->options);
+					run->done(std::make_exception_ptr(loging::MakeException(error_msg)));
+					return;
+				}
 				loging::LogError(error_msg + " (ignored)");
-				continue;
+				run->failed = true;
 			}
-			throw loging::MakeException(error_msg);
-		}
+
+			try
+			{
+				RunCommands(run);
+			}
+			catch (...)
+			{
+				run->done(std::current_exception());
+			}
+		});
+		return;
 	}
-	return true;
-}
 
-std::string Rule::PrepareCommand(std::string command, const MakeOptions& options)
-{
-  command = ExpandVariables(command, options.vars);
-
-  std::string target_str = target_.string();
-  std::string stem_str = stem_;
-    
-  std::string first_dep = dependencies_.empty() ? "" : dependencies_[0].string();
-  std::string first_dep_filename = dependencies_.empty() ? "" : dependencies_[0].filename().string();
-  std::string first_dep_dir = dependencies_.empty() ? "" : dependencies_[0].parent_path().string();
-    
-  std::string deps;  // $+
-  for (const auto& dep : dependencies_)
-    deps += (deps.empty() ? "" : " ") + dep.string();
-    
-  std::string unique_deps;  // $^
-  for (const auto& dep : std::set(dependencies_.begin(), dependencies_.end()))
-    unique_deps += (unique_deps.empty() ? "" : " ") + dep.string();
-    
-  std::string new_deps;  // $?
-  if (!fs::exists(target_)) 
+	InvalidateTargetDirectory(options);
+	if (run->cache_key && !run->failed)
 	{
-  	for (const fs::path& dep : dependencies_)
-      new_deps += (new_deps.empty() ? "" : " ") + dep.string();
-  } 
-	else 
-	{
-    auto target_time = fs::last_write_time(target_);
-      for (const fs::path& dep : dependencies_)
-        if (fs::exists(dep) && target_time < fs::last_write_time(dep))
-          new_deps += (new_deps.empty() ? "" : " ") + dep.string();
-  }
-    
-  std::string deps_filenames, deps_dirs;
-  for (const auto& dep : dependencies_) 
+		DirectoryCache& dirs = (options.expander ? *options.expander : DefaultExpander()).Directories();
+		options.cache->Store(*run->cache_key, ResolveAll(dirs, GetOutputs()));
+	}
+	run->done(nullptr);
+}
+
+std::vector<std::string> Rule::ExpandCommands(const MakeOptions& options)
+{
+	std::vector<fs::path> dependency_scratch;
+	std::vector<fs::path> order_only_scratch;
+	return ExpandCommands(options, GetDependencies(dependency_scratch), GetOrderOnlyPrerequisites(order_only_scratch));
+}
+
+std::vector<std::string> Rule::ExpandCommands(const MakeOptions& options, const std::vector<fs::path>& dependencies,
+                                              const std::vector<fs::path>& order_only)
+{
+	Expander& expander = options.expander ? *options.expander : DefaultExpander();
+	VariableTable& globals = options.variables ? *options.variables : DefaultVariables();
+	RecipeScope scope(target_, dependencies, order_only, stem_, expander.Directories(), variables_.get(), globals);
+
+	std::vector<std::string> commands;
+	if (pattern_)
 	{
-    if (!deps_filenames.empty()) deps_filenames += " ";
-    	deps_filenames += dep.filename().string();
-    if (!deps_dirs.empty()) deps_dirs += " ";
-      deps_dirs += dep.parent_path().string();
-  }
-    
-  std::string target_filename = target_.filename().string();
-  std::string target_dir = target_.parent_path().string();
-    
-  std::vector<std::pair<std::string_view, std::string>> replacements = {
-        {"$(@F)", target_filename},
-        {"$(@D)", target_dir},
-        {"$(<F)", first_dep_filename},
-        {"$(<D)", first_dep_dir},
-        {"$(^F)", deps_filenames},
-        {"$(^D)", deps_dirs},
-        {"$@", target_str},
-        {"$<", first_dep},
-        {"$+", deps},
-        {"$^", unique_deps},
-        {"$?", new_deps},
-        {"$*", stem_str},
-    };
-    
-  for (const auto& [pattern, replacement] : replacements) 
+		for (const std::string& com : pattern_->commands)
+			commands.push_back(expander.Expand(SubstituteStem(com, stem_), scope));
+	}
+	else if (commands_)
 	{
-  	size_t pos = 0;
-    while ((pos = command.find(pattern, pos)) != std::string::npos) 
-		{
-      command.replace(pos, pattern.length(), replacement);
-      pos += replacement.length();
-    }
-  }
-  return command;
+		for (const std::string& com : *commands_)
+			commands.push_back(expander.Expand(com, scope));
+	}
+	return commands;
 }
 
 Rule::Rule(fs::path target,
@@ -212,9 +340,78 @@ Rule::Rule(fs::path target,
        std::vector<fs::path> prereqs, 
        std::vector<std::string> commands,
 			 std::string stem)
-			 : target_(target)
-			 , dependencies_(dependencies)
-       , order_only_prerequisites_(prereqs)
-			 , commands_(commands)
-			 , stem_(stem)
-{}
\ No newline at end of file
+			 : Rule(std::move(target), std::move(dependencies), std::move(prereqs),
+			        std::make_shared<const Recipe>(std::move(commands)), std::move(stem))
+{}
+
+Rule::Rule(fs::path target,
+       std::vector<fs::path> dependencies,
+       std::vector<fs::path> prereqs,
+       std::shared_ptr<const Recipe> commands,
+			 std::string stem)
+			 : target_(std::move(target))
+			 , dependencies_(std::move(dependencies))
+			 , commands_(std::move(commands))
+			 , stem_(std::move(stem))
+			 , order_only_prerequisites_(std::move(prereqs))
+{}
+
+Rule::Rule(fs::path target, const PatternRule& pattern, std::string stem)
+			 : target_(std::move(target))
+			 , stem_(std::move(stem))
+			 , pattern_(&pattern)
+{}
+
+namespace
+{
+	const std::vector<fs::path>& SubstituteAll(const std::vector<std::string>& patterns, const std::string& stem,
+	                                           std::vector<fs::path>& scratch)
+	{
+		scratch.clear();
+		scratch.reserve(patterns.size());
+		for (const std::string& pattern : patterns)
+			scratch.emplace_back(SubstituteStem(pattern, stem));
+		return scratch;
+	}
+}
+
+const std::vector<fs::path>& Rule::GetDependencies(std::vector<fs::path>& scratch) const
+{
+	if (!pattern_ || dependencies_set_)
+		return dependencies_;
+	return SubstituteAll(pattern_->deps, stem_, scratch);
+}
+
+const std::vector<fs::path>& Rule::GetOrderOnlyPrerequisites(std::vector<fs::path>& scratch) const
+{
+	if (!pattern_)
+		return order_only_prerequisites_;
+	return SubstituteAll(pattern_->order_only_deps, stem_, scratch);
+}
+
+std::vector<fs::path> Rule::GetOutputs() const
+{
+	if (group_)
+		return *group_;
+	return {target_};
+}
+
+void Rule::SetDependencies(std::vector<fs::path> dependencies)
+{
+	dependencies_ = std::move(dependencies);
+	dependencies_set_ = true;
+}
+
+bool Rule::operator==(const Rule& other) const
+{
+	auto same_recipe = [](const std::shared_ptr<const Recipe>& lhs, const std::shared_ptr<const Recipe>& rhs)
+	{
+		if (lhs == rhs) return true;
+		return (lhs ? *lhs : Recipe()) == (rhs ? *rhs : Recipe());
+	};
+	return target_ == other.target_ && dependencies_ == other.dependencies_ &&
+	       same_recipe(commands_, other.commands_) && is_phony_ == other.is_phony_ && stem_ == other.stem_ &&
+	       order_only_prerequisites_ == other.order_only_prerequisites_ && variables_ == other.variables_ &&
+	       pattern_ == other.pattern_ && dependencies_set_ == other.dependencies_set_ &&
+	       GetOutputs() == other.GetOutputs() && waits_ == other.waits_;
+}
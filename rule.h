@@ -1,22 +1,49 @@
 #pragma once
+#include <exception>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <vector>
 #include <string>
 
 #include "options.h"
+#include "target_vars.h"
 
 namespace fs = std::filesystem;
 
+struct PatternRule;
+struct RecipeRun;
+
+// recipe lines as written, shared by all rules of one rule header
+using Recipe = std::vector<std::string>;
+
 class Rule
 {
   fs::path target_;
+  // empty for a rule made from a pattern, unless VPATH resolution set them
   std::vector<fs::path> dependencies_;
-  std::vector<std::string> commands_;
+  std::shared_ptr<const Recipe> commands_;
   bool is_phony_ = false;
   std::string stem_;
   std::vector<fs::path> order_only_prerequisites_;
+  std::shared_ptr<const VariableLayer> variables_;
+  // Set for a rule made from a pattern rule: prerequisites and recipe lines
+  // are substituted into the caller's buffer each time they are used, so an
+  // instance keeps only its stem.
+  const PatternRule* pattern_ = nullptr;
+  // dependencies_ hold the VPATH-resolved ones of a pattern instance
+  bool dependencies_set_ = false;
+  // all targets of a grouped rule (a b &: c), which one run of the recipe
+  // makes together
+  std::shared_ptr<const std::vector<fs::path>> group_;
+  // indexes into dependencies_ that had a .WAIT before them
+  std::vector<size_t> waits_;
 
-  std::string PrepareCommand(std::string command, const MakeOptions& options);
+  std::vector<std::string> ExpandCommands(const MakeOptions& options, const std::vector<fs::path>& dependencies,
+                                         const std::vector<fs::path>& order_only);
+  void InvalidateTargetDirectory(const MakeOptions& options) const;
+  void RunCommands(const std::shared_ptr<RecipeRun>& run);
 
 public:
   Rule(fs::path target,
@@ -24,16 +51,45 @@ public:
        std::vector<fs::path> prereqs, 
        std::vector<std::string> commands,
        std::string stem = "");
-  
+  Rule(fs::path target,
+       std::vector<fs::path> dependencies,
+       std::vector<fs::path> prereqs,
+       std::shared_ptr<const Recipe> commands,
+       std::string stem = "");
+  // target made by pattern, which must outlive the rule
+  Rule(fs::path target, const PatternRule& pattern, std::string stem);
+
   Rule() = default;
 
   fs::path GetTarget() const {return target_;}
-  std::vector<fs::path> GetDependencies() const {return dependencies_;}
-  const std::vector<fs::path>& GetOrderOnlyPrerequisites() const {return order_only_prerequisites_;}
+  // The prerequisites as written, or substituted into scratch for a rule
+  // made from a pattern; the result is valid while both are.
+  const std::vector<fs::path>& GetDependencies(std::vector<fs::path>& scratch) const;
+  const std::vector<fs::path>& GetOrderOnlyPrerequisites(std::vector<fs::path>& scratch) const;
 
+  // the group's targets, or just this one
+  std::vector<fs::path> GetOutputs() const;
+  bool IsGrouped() const {return group_ != nullptr;}
+
+  void SetDependencies(std::vector<fs::path> dependencies);
+  void SetGroup(std::shared_ptr<const std::vector<fs::path>> group) {group_ = std::move(group);}
+  const std::vector<size_t>& GetWaits() const {return waits_;}
+  void SetWaits(std::vector<size_t> waits) {waits_ = std::move(waits);}
+  void SetVariables(std::shared_ptr<const VariableLayer> variables) {variables_ = std::move(variables);}
   void SetPhony() {is_phony_ = true;}
+  bool IsPhony() const {return is_phony_;}
+  // recipes are compared by their lines
+  bool operator==(const Rule& other) const;
+
+  // the recipe lines with every variable expanded
+  std::vector<std::string> ExpandCommands(const MakeOptions& options);
 
   bool CheckOrderOnlyPrerequisites() const;
   bool IsNeedRebuild(const MakeOptions& options) const;
+  // the same check as IsNeedRebuild, with the reason as text
+  std::optional<std::string> OutOfDateReason(const MakeOptions& options) const;
   bool Run(const MakeOptions& options);
+  // Starts the recipe and calls done once its last command finished or
+  // one of them failed; done may run on another thread.
+  void RunAsync(const MakeOptions& options, std::function<void(std::exception_ptr)> done);
 };
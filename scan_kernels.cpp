@@ -0,0 +1,271 @@
+#include "scan_kernels.h"
+
+#include <array>
+#include <bit>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SCAN_KERNELS_X86 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SCAN_KERNELS_NEON 1
+#endif
+
+namespace
+{
+  constexpr char kScanChars[8] = {'$', ':', '=', '|', '#', '\\', '\t', '\n'};
+
+  constexpr std::array<ScanSet, 256> kScanTable = []() {
+    std::array<ScanSet, 256> table{};
+    for (int i = 0; i < 8; ++i)
+      table[static_cast<unsigned char>(kScanChars[i])] = static_cast<ScanSet>(1 << i);
+    return table;
+  }();
+
+  // the characters of a set, worked out once per scan
+  struct ScanNeedles
+  {
+    char chars[16] = {};
+    int count = 0;
+  };
+
+  ScanNeedles MakeNeedles(ScanSet set)
+  {
+    ScanNeedles needles;
+    for (int i = 0; i < 8; ++i)
+      if (set & (1 << i))
+        needles.chars[needles.count++] = kScanChars[i];
+    return needles;
+  }
+
+  constexpr std::array<bool, 256> kWhitespaceTable = []() {
+    std::array<bool, 256> table{};
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+      table[static_cast<unsigned char>(c)] = true;
+    return table;
+  }();
+
+  using MaskKernel = uint64_t (*)(const char* block, const ScanNeedles& needles);
+  using WhitespaceKernel = uint64_t (*)(const char* block);
+
+  uint64_t MaskScalar(const char* block, const ScanNeedles& needles)
+  {
+    ScanSet set = 0;
+    for (int i = 0; i < needles.count; ++i)
+      set |= kScanTable[static_cast<unsigned char>(needles.chars[i])];
+
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; ++i)
+      if (kScanTable[static_cast<unsigned char>(block[i])] & set)
+        mask |= uint64_t{1} << i;
+    return mask;
+  }
+
+  uint64_t WhitespaceScalar(const char* block)
+  {
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; ++i)
+      if (kWhitespaceTable[static_cast<unsigned char>(block[i])])
+        mask |= uint64_t{1} << i;
+    return mask;
+  }
+
+#ifdef SCAN_KERNELS_X86
+  __attribute__((target("avx2")))
+  uint64_t MaskAvx2(const char* block, const ScanNeedles& needles)
+  {
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    __m256i low_hits = _mm256_setzero_si256();
+    __m256i high_hits = _mm256_setzero_si256();
+    for (int i = 0; i < needles.count; ++i)
+    {
+      __m256i needle = _mm256_set1_epi8(needles.chars[i]);
+      low_hits = _mm256_or_si256(low_hits, _mm256_cmpeq_epi8(low, needle));
+      high_hits = _mm256_or_si256(high_hits, _mm256_cmpeq_epi8(high, needle));
+    }
+    return static_cast<uint32_t>(_mm256_movemask_epi8(low_hits)) |
+           static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(high_hits))) << 32;
+  }
+
+  // \t..\r are 9..13: after subtracting 9 they are the bytes no larger than 4
+  __attribute__((target("avx2")))
+  uint64_t WhitespaceAvx2(const char* block)
+  {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i control_base = _mm256_set1_epi8(9);
+    const __m256i control_range = _mm256_set1_epi8(4);
+
+    uint64_t mask = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+      __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+      __m256i shifted = _mm256_sub_epi8(bytes, control_base);
+      __m256i is_control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, control_range), shifted);
+      __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), is_control);
+      mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hits))) << (32 * i);
+    }
+    return mask;
+  }
+
+  // PCMPESTRM compares 16 bytes against the whole set in one instruction
+  __attribute__((target("sse4.2")))
+  uint64_t MaskSse42(const char* block, const ScanNeedles& needles)
+  {
+    constexpr int kMode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK;
+    __m128i set = _mm_loadu_si128(reinterpret_cast<const __m128i*>(needles.chars));
+
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+      __m128i hits = _mm_cmpestrm(set, needles.count, bytes, 16, kMode);
+      mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_cvtsi128_si32(hits))) << (16 * i);
+    }
+    return mask;
+  }
+
+  __attribute__((target("sse4.2")))
+  uint64_t WhitespaceSse42(const char* block)
+  {
+    static const ScanNeedles kWhitespace = {{' ', '\t', '\n', '\v', '\f', '\r'}, 6};
+    return MaskSse42(block, kWhitespace);
+  }
+#endif
+
+#ifdef SCAN_KERNELS_NEON
+  // NEON has no movemask: every lane keeps its own bit, and pairwise adds
+  // fold 16 lanes into 16 bits
+  uint64_t MoveMaskNeon(uint8x16_t hits)
+  {
+    static const uint8_t kWeights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(hits, vld1q_u8(kWeights));
+    uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+    sum = vpadd_u8(sum, sum);
+    sum = vpadd_u8(sum, sum);
+    return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
+  }
+
+  uint64_t MaskNeon(const char* block, const ScanNeedles& needles)
+  {
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(block + 16 * i));
+      uint8x16_t hits = vdupq_n_u8(0);
+      for (int j = 0; j < needles.count; ++j)
+        hits = vorrq_u8(hits, vceqq_u8(bytes, vdupq_n_u8(static_cast<uint8_t>(needles.chars[j]))));
+      mask |= MoveMaskNeon(hits) << (16 * i);
+    }
+    return mask;
+  }
+
+  uint64_t WhitespaceNeon(const char* block)
+  {
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(block + 16 * i));
+      uint8x16_t is_control = vcleq_u8(vsubq_u8(bytes, vdupq_n_u8(9)), vdupq_n_u8(4));
+      uint8x16_t hits = vorrq_u8(vceqq_u8(bytes, vdupq_n_u8(' ')), is_control);
+      mask |= MoveMaskNeon(hits) << (16 * i);
+    }
+    return mask;
+  }
+#endif
+
+  struct KernelInfo
+  {
+    const char* name;
+    MaskKernel kernel;
+    WhitespaceKernel whitespace;
+    bool (*supported)();
+  };
+
+  const std::array kKernels = {
+#ifdef SCAN_KERNELS_X86
+    KernelInfo{"avx2", MaskAvx2, WhitespaceAvx2, []() { return __builtin_cpu_supports("avx2") != 0; }},
+    KernelInfo{"sse4.2", MaskSse42, WhitespaceSse42, []() { return __builtin_cpu_supports("sse4.2") != 0; }},
+#endif
+#ifdef SCAN_KERNELS_NEON
+    KernelInfo{"neon", MaskNeon, WhitespaceNeon, []() { return true; }},
+#endif
+    KernelInfo{"scalar", MaskScalar, WhitespaceScalar, []() { return true; }},
+  };
+
+  const KernelInfo*& ActiveKernel()
+  {
+    static const KernelInfo* active = []() {
+      for (const KernelInfo& info : kKernels)
+        if (info.supported())
+          return &info;
+      return &kKernels.back();
+    }();
+    return active;
+  }
+}
+
+ScanSet ScanClass(char c)
+{
+  return kScanTable[static_cast<unsigned char>(c)];
+}
+
+uint64_t ScanMask64(const char* block, ScanSet set)
+{
+  return ActiveKernel()->kernel(block, MakeNeedles(set));
+}
+
+uint64_t ScanWhitespace64(const char* block)
+{
+  return ActiveKernel()->whitespace(block);
+}
+
+size_t ScanFind(std::string_view text, ScanSet set, size_t pos)
+{
+  const char* data = text.data();
+  size_t size = text.size();
+
+  if (pos + 64 <= size)
+  {
+    ScanNeedles needles = MakeNeedles(set);
+    MaskKernel kernel = ActiveKernel()->kernel;
+    for (; pos + 64 <= size; pos += 64)
+    {
+      uint64_t mask = kernel(data + pos, needles);
+      if (mask != 0)
+        return pos + static_cast<size_t>(std::countr_zero(mask));
+    }
+  }
+
+  for (; pos < size; ++pos)
+    if (kScanTable[static_cast<unsigned char>(data[pos])] & set)
+      return pos;
+  return std::string_view::npos;
+}
+
+const char* ScanKernelName()
+{
+  return ActiveKernel()->name;
+}
+
+std::vector<const char*> AvailableScanKernels()
+{
+  std::vector<const char*> names;
+  for (const KernelInfo& info : kKernels)
+    if (info.supported())
+      names.push_back(info.name);
+  return names;
+}
+
+bool SelectScanKernel(std::string_view name)
+{
+  for (const KernelInfo& info : kKernels)
+  {
+    if (name == info.name && info.supported())
+    {
+      ActiveKernel() = &info;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Scanners for the characters Makefile syntax is built on. A set of them is
+// searched in one pass, 64 bytes per step, by the widest kernel the CPU
+// supports: AVX2 or SSE4.2 on x86 (chosen at startup), NEON on ARM, and a
+// table lookup everywhere else.
+
+using ScanSet = uint8_t;
+
+constexpr ScanSet kScanDollar = 1 << 0;     // $
+constexpr ScanSet kScanColon = 1 << 1;      // :
+constexpr ScanSet kScanEquals = 1 << 2;     // =
+constexpr ScanSet kScanBar = 1 << 3;        // |
+constexpr ScanSet kScanHash = 1 << 4;       // #
+constexpr ScanSet kScanBackslash = 1 << 5;  // \ (backslash)
+constexpr ScanSet kScanTab = 1 << 6;        // \t
+constexpr ScanSet kScanNewline = 1 << 7;    // \n
+
+// the member of the set c is, 0 for every other character
+ScanSet ScanClass(char c);
+
+// Bit i is set when block[i] is in set; block must have 64 readable bytes.
+uint64_t ScanMask64(const char* block, ScanSet set);
+
+// Bit i is set when block[i] is a space or one of \t \n \v \f \r, the
+// separators of a word list; block must have 64 readable bytes.
+uint64_t ScanWhitespace64(const char* block);
+
+// Position of the first character in set at or after pos, or npos.
+size_t ScanFind(std::string_view text, ScanSet set, size_t pos = 0);
+
+// "avx2", "sse4.2", "neon" or "scalar"
+const char* ScanKernelName();
+// the kernels this CPU can run, the fastest first
+std::vector<const char*> AvailableScanKernels();
+// Switches to another kernel, for benchmarks; false if it can't run here.
+bool SelectScanKernel(std::string_view name);
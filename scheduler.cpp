@@ -0,0 +1,291 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+
+#include "logger.h"
+
+bool JobTokens::TryAcquire()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_ == 0) return false;
+  free_--;
+  return true;
+}
+
+void JobTokens::Release()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_++;
+  for (auto& [watcher, wake] : watchers_)
+    wake();
+}
+
+size_t JobTokens::Watch(std::function<void()> wake)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  watchers_.emplace(next_watcher_, std::move(wake));
+  return next_watcher_++;
+}
+
+void JobTokens::Unwatch(size_t watcher)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  watchers_.erase(watcher);
+}
+
+bool BuildScheduler::HasHigherPriority(const BuildGraph& graph, NodeId lhs, NodeId rhs)
+{
+  uint64_t lhs_path = graph.GetCriticalPath(lhs);
+  uint64_t rhs_path = graph.GetCriticalPath(rhs);
+  if (lhs_path != rhs_path)
+    return lhs_path > rhs_path;
+  size_t lhs_fan_out = graph.GetDependents(lhs).size();
+  size_t rhs_fan_out = graph.GetDependents(rhs).size();
+  if (lhs_fan_out != rhs_fan_out)
+    return lhs_fan_out > rhs_fan_out;
+  return lhs < rhs;
+}
+
+void BuildScheduler::Run(const BuildGraph& graph, const Job& job, size_t jobs, bool keep_going, JobTokens* tokens)
+{
+  if (jobs == 0) jobs = 1;
+
+  // numbered when they first become ready, for Order::kReadyFirst
+  std::vector<uint64_t> ready_order(graph.Size(), 0);
+  uint64_t ready_count = 0;
+  auto lower_priority = [this, &graph, &ready_order](NodeId lhs, NodeId rhs)
+  {
+    if (order_ == Order::kReadyFirst)
+      return ready_order[lhs] > ready_order[rhs];
+    return HasHigherPriority(graph, rhs, lhs);
+  };
+  std::priority_queue<NodeId, std::vector<NodeId>, decltype(lower_priority)> ready(lower_priority);
+  auto make_ready = [&](NodeId id)
+  {
+    if (ready_order[id] == 0)
+      ready_order[id] = ++ready_count;
+    ready.push(id);
+  };
+
+  // only edges from nodes with a rule are waited for
+  std::vector<uint32_t> waiting(graph.Size(), 0);
+  std::vector<bool> blocked(graph.Size(), false);
+  for (NodeId id = 0; id < graph.Size(); ++id)
+  {
+    if (!graph.HasFlag(id, BuildGraph::kHasRule)) continue;
+    for (NodeId prerequisite : graph.GetPrerequisites(id))
+      waiting[id] += graph.HasFlag(prerequisite, BuildGraph::kHasRule);
+    for (NodeId prerequisite : graph.GetOrderOnly(id))
+      waiting[id] += graph.HasFlag(prerequisite, BuildGraph::kHasRule);
+  }
+
+  // nodes after a .WAIT are held until the nodes before it are done
+  std::vector<uint32_t> held(graph.Size(), 0);
+  std::vector<size_t> barrier_pending(graph.GetBarrierCount());
+  std::unordered_multimap<NodeId, size_t> barriers_before;
+  for (size_t barrier = 0; barrier < graph.GetBarrierCount(); ++barrier)
+  {
+    barrier_pending[barrier] = graph.GetBarrierBefore(barrier).size();
+    for (NodeId id : graph.GetBarrierBefore(barrier))
+      barriers_before.emplace(id, barrier);
+    for (NodeId id : graph.GetBarrierAfter(barrier))
+      held[id]++;
+  }
+
+  for (NodeId id = 0; id < graph.Size(); ++id)
+    if (graph.HasFlag(id, BuildGraph::kHasRule) && waiting[id] == 0 && held[id] == 0)
+      make_ready(id);
+
+  // nodes of a full pool wait in a heap of their own
+  std::vector<size_t> pool_running(graph.GetPoolCount(), 0);
+  std::vector<std::vector<NodeId>> pool_waiting(graph.GetPoolCount());
+
+  size_t running = 0;
+  std::exception_ptr error;
+
+  auto release_barriers = [&](NodeId id)
+  {
+    auto [begin, end] = barriers_before.equal_range(id);
+    for (auto it = begin; it != end; ++it)
+    {
+      if (--barrier_pending[it->second] != 0) continue;
+      for (NodeId after : graph.GetBarrierAfter(it->second))
+        if (--held[after] == 0 && waiting[after] == 0 && !blocked[after])
+          make_ready(after);
+    }
+  };
+
+  auto finish = [&](NodeId id, bool ok)
+  {
+    std::vector<std::pair<NodeId, bool>> stack = {{id, ok}};
+    while (!stack.empty())
+    {
+      auto [current, current_ok] = stack.back();
+      stack.pop_back();
+      release_barriers(current);
+
+      for (NodeId dependent : graph.GetDependents(current))
+      {
+        if (!current_ok)
+          blocked[dependent] = true;
+        if (--waiting[dependent] != 0)
+          continue;
+
+        if (blocked[dependent])
+        {
+          loging::LogError("Target '" + graph.GetName(dependent) + "' not remade because of errors.");
+          stack.push_back({dependent, false});
+        }
+        else if (held[dependent] == 0)
+          make_ready(dependent);
+      }
+    }
+  };
+
+  struct Done
+  {
+    NodeId id;
+    bool ok;
+    std::exception_ptr error;
+  };
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<Done> done;
+  // set when another scheduler gave a token back
+  bool token_released = false;
+
+  auto complete = [&](NodeId id, bool ok, std::exception_ptr job_error)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done.push_back({id, ok, job_error});
+    cv.notify_one();
+  };
+
+  struct Watch
+  {
+    JobTokens* tokens;
+    size_t watcher = 0;
+    ~Watch() { if (tokens) tokens->Unwatch(watcher); }
+  } watch{tokens};
+  if (tokens)
+  {
+    watch.watcher = tokens->Watch([&]
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      token_released = true;
+      cv.notify_one();
+    });
+  }
+
+  while (true)
+  {
+    while (!error && running < jobs && !ready.empty())
+    {
+      NodeId id = ready.top();
+      ready.pop();
+      uint16_t pool = graph.GetPool(id);
+      if (pool != 0 && pool_running[pool] == graph.GetPoolDepth(pool))
+      {
+        pool_waiting[pool].push_back(id);
+        std::push_heap(pool_waiting[pool].begin(), pool_waiting[pool].end(), lower_priority);
+        continue;
+      }
+      // the first job is free, every other one holds a token
+      if (tokens && running > 0 && !tokens->TryAcquire())
+      {
+        make_ready(id);
+        break;
+      }
+      if (pool != 0)
+        pool_running[pool]++;
+      ++running;
+      try
+      {
+        job(id, [&complete, id](bool ok, std::exception_ptr job_error) { complete(id, ok, job_error); });
+      }
+      catch (...)
+      {
+        complete(id, false, std::current_exception());
+      }
+    }
+
+    if (running == 0 && !error && ready.empty())
+    {
+      // a .WAIT that contradicts the edges can never be released
+      bool released = false;
+      for (NodeId id = 0; id < graph.Size(); ++id)
+      {
+        if (held[id] == 0 || waiting[id] != 0 || blocked[id]) continue;
+        held[id] = 0;
+        make_ready(id);
+        released = true;
+      }
+      if (released)
+      {
+        loging::LogError(".WAIT conflicts with the prerequisites of its targets; ignoring it.");
+        continue;
+      }
+    }
+
+    if (running == 0)
+      break;
+
+    std::vector<Done> finished;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return !done.empty() || token_released; });
+      token_released = false;
+      finished.swap(done);
+    }
+
+    for (Done& item : finished)
+    {
+      --running;
+      if (tokens && running > 0)
+        tokens->Release();
+      uint16_t pool = graph.GetPool(item.id);
+      if (pool != 0)
+      {
+        pool_running[pool]--;
+        if (!pool_waiting[pool].empty())
+        {
+          std::pop_heap(pool_waiting[pool].begin(), pool_waiting[pool].end(), lower_priority);
+          make_ready(pool_waiting[pool].back());
+          pool_waiting[pool].pop_back();
+        }
+      }
+      if (item.error)
+      {
+        if (!keep_going)
+        {
+          if (!error) error = item.error;
+          continue;
+        }
+        try
+        {
+          std::rethrow_exception(item.error);
+        }
+        catch (const std::exception& e)
+        {
+          loging::LogError("Error building target '" + graph.GetName(item.id) + "': " + e.what());
+        }
+        catch (...)
+        {
+          if (!error) error = item.error;
+          continue;
+        }
+        item.ok = false;
+      }
+      if (!error)
+        finish(item.id, item.ok);
+    }
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+}
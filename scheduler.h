@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "build_graph.h"
+
+// Job slots shared by a make and the makes its recipes run in process, like
+// the jobserver of GNU make: every scheduler may run one job on its own and
+// takes a token for each further one.
+class JobTokens
+{
+  std::mutex mutex_;
+  size_t free_;
+  size_t next_watcher_ = 0;
+  std::unordered_map<size_t, std::function<void()>> watchers_;
+
+public:
+  explicit JobTokens(size_t tokens) : free_(tokens) {}
+
+  bool TryAcquire();
+  void Release();
+
+  // wake is called, on any thread, whenever a token is released
+  size_t Watch(std::function<void()> wake);
+  void Unwatch(size_t watcher);
+};
+
+// Runs the nodes of a dependency graph once all of their prerequisites are
+// done. When several nodes are ready, the one with the longest remaining
+// path to the goals starts first; nodes without recorded durations fall back
+// to their fan-out and then to the order they were added in. A node of a
+// resource pool also waits for a free slot in it, and one held by a .WAIT
+// barrier for the nodes before the barrier.
+class BuildScheduler
+{
+public:
+  using NodeId = BuildGraph::NodeId;
+  // which ready node starts first; kReadyFirst, in the order the nodes
+  // became ready, is the baseline benchmarks compare against
+  enum class Order
+  {
+    kCriticalPath,
+    kReadyFirst,
+  };
+  // ok is false when the node failed and its dependents must not run; error
+  // is set when the job failed with an exception
+  using Completion = std::function<void(bool ok, std::exception_ptr error)>;
+  // starts the node and calls the completion once, from any thread
+  using Job = std::function<void(NodeId, Completion)>;
+
+private:
+  Order order_;
+
+  static bool HasHigherPriority(const BuildGraph& graph, NodeId lhs, NodeId rhs);
+
+public:
+  explicit BuildScheduler(Order order = Order::kCriticalPath) : order_(order) {}
+
+  // Runs the nodes with a rule; files without one count as done from the
+  // start. The graph must be finalized. Up to `jobs` nodes run at once, all
+  // started from the calling thread, which otherwise sleeps until a
+  // completion arrives. With tokens, jobs beyond the first also need one of
+  // them. Job errors are rethrown after the running jobs finish unless
+  // keep_going is set.
+  void Run(const BuildGraph& graph, const Job& job, size_t jobs, bool keep_going, JobTokens* tokens = nullptr);
+};
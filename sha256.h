@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Incremental SHA-256, used to key cached build artifacts.
+class Sha256
+{
+  std::array<uint32_t, 8> state_;
+  std::array<unsigned char, 64> block_{};
+  size_t block_size_ = 0;
+  uint64_t total_size_ = 0;
+
+  void Transform(const unsigned char* block);
+
+public:
+  Sha256();
+
+  void Update(const void* data, size_t size);
+  void Update(std::string_view data) {Update(data.data(), data.size());}
+
+  std::string HexDigest();
+};
@@ -0,0 +1,136 @@
+#include "target_vars.h"
+
+namespace
+{
+  // the text a recursive expansion turns back into text
+  void AppendEscaped(std::string_view text, std::string& out)
+  {
+    for (char c : text)
+    {
+      if (c == '$')
+        out += '$';
+      out += c;
+    }
+  }
+}
+
+void VariableLayer::Collect(std::string_view name, std::vector<const Value*>& parts) const
+{
+  // later values of the same name win
+  for (const VariableLayer* layer = this; layer != nullptr; layer = layer->parent_.get())
+  {
+    for (auto it = layer->values_.rbegin(); it != layer->values_.rend(); ++it)
+    {
+      if (it->name != name) continue;
+      parts.push_back(&*it);
+      if (!it->append)
+        return;
+    }
+  }
+}
+
+std::optional<VariableRef> VariableLayer::Lookup(std::string_view name, VariableScope& globals,
+                                                 Composed& composed) const
+{
+  std::vector<const Value*> parts;
+  Collect(name, parts);
+
+  std::optional<VariableRef> base;
+  if (!parts.empty() && !parts.back()->append)
+  {
+    base = VariableRef{parts.back()->text, parts.back()->recursive};
+    parts.pop_back();
+  }
+  else
+    base = globals.Lookup(name);
+  if (parts.empty())
+    return base;
+
+  auto known = composed.find(std::string(name));
+  if (known != composed.end())
+    return VariableRef{known->second.first, known->second.second};
+
+  bool recursive = base && base->recursive;
+  for (const Value* part : parts)
+    recursive = recursive || part->recursive;
+
+  std::string text;
+  auto append = [&](std::string_view value, bool value_recursive)
+  {
+    if (recursive && !value_recursive)
+      AppendEscaped(value, text);
+    else
+      text.append(value);
+  };
+  if (base)
+    append(base->value, base->recursive);
+  for (auto it = parts.rbegin(); it != parts.rend(); ++it)
+  {
+    if (!text.empty())
+      text += ' ';
+    append((*it)->text, (*it)->recursive);
+  }
+
+  const auto& [stored, stored_recursive] =
+    composed.emplace(std::string(name), std::pair{std::move(text), recursive}).first->second;
+  return VariableRef{stored, stored_recursive};
+}
+
+std::shared_ptr<const VariableLayer> VariableLayer::Extend(std::shared_ptr<const VariableLayer> parent,
+                                                           const std::vector<const VariableAssignments*>& assignments,
+                                                           VariableScope& globals)
+{
+  bool empty = true;
+  for (const VariableAssignments* list : assignments)
+    empty = empty && list->empty();
+  if (empty)
+    return parent;
+
+  auto layer = std::make_shared<VariableLayer>();
+  layer->parent_ = std::move(parent);
+
+  auto defined = [&](std::string_view name) {
+    std::vector<const Value*> parts;
+    layer->Collect(name, parts);
+    return !parts.empty() || globals.Lookup(name).has_value();
+  };
+
+  for (const VariableAssignments* list : assignments)
+  {
+    for (const VariableAssignment& assignment : *list)
+    {
+      switch (assignment.op)
+      {
+        case AssignOp::kRecursive:
+          layer->values_.push_back({assignment.name, assignment.value, true, false});
+          break;
+
+        case AssignOp::kSimple:
+          layer->values_.push_back({assignment.name, assignment.value, false, false});
+          break;
+
+        // the appended text is expanded when the variable is, whatever the
+        // flavour of the value it extends
+        case AssignOp::kAppend:
+        {
+          bool recursive = assignment.value.find('$') != std::string::npos;
+          layer->values_.push_back({assignment.name, assignment.value, recursive, true});
+          break;
+        }
+
+        case AssignOp::kConditional:
+          if (!defined(assignment.name))
+            layer->values_.push_back({assignment.name, assignment.value, true, false});
+          break;
+      }
+    }
+  }
+  return layer;
+}
+
+std::optional<VariableRef> LayeredScope::Lookup(std::string_view name)
+{
+  if (layer_ == nullptr)
+    return parent_.Lookup(name);
+  return layer_->Lookup(name, parent_, composed_);
+}
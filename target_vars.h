@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expander.h"
+
+enum class AssignOp
+{
+  kRecursive,    // =
+  kSimple,       // :=, the value is expanded when the line is read
+  kAppend,       // +=
+  kConditional,  // ?=
+};
+
+struct VariableAssignment
+{
+  std::string name;
+  std::string value;
+  AssignOp op = AssignOp::kRecursive;
+
+  bool operator==(const VariableAssignment&) const = default;
+};
+
+using VariableAssignments = std::vector<VariableAssignment>;
+
+// Target- and pattern-specific variables of one target. A layer holds only
+// the names it overrides and links to the layer of the target that asked
+// for it to be built, so prerequisites see their dependents' values without
+// any map being copied. A += keeps only the appended text, which is joined
+// to the value it extends when the variable is looked up.
+class VariableLayer
+{
+  struct Value
+  {
+    std::string name;
+    std::string text;
+    bool recursive;
+    bool append;
+  };
+
+  std::shared_ptr<const VariableLayer> parent_;
+  std::vector<Value> values_;
+
+  // the assignments of name from the nearest one outwards, ending at the
+  // first one that isn't a +=
+  void Collect(std::string_view name, std::vector<const Value*>& parts) const;
+
+public:
+  // Returns parent itself when there is nothing to override. ?= is resolved
+  // here against the parent chain and then the globals.
+  static std::shared_ptr<const VariableLayer> Extend(std::shared_ptr<const VariableLayer> parent,
+                                                     const std::vector<const VariableAssignments*>& assignments,
+                                                     VariableScope& globals);
+
+  // The value of name, falling back to globals. A value with += parts is
+  // joined into composed; each part keeps its own flavour, so the simple
+  // ones come out as they are even when the joined value is recursive.
+  // joined values by name, with their flavour; they are made once and
+  // stay put while references to them are expanded
+  using Composed = std::unordered_map<std::string, std::pair<std::string, bool>>;
+  std::optional<VariableRef> Lookup(std::string_view name, VariableScope& globals, Composed& composed) const;
+};
+
+// A layer chain in front of another scope.
+class LayeredScope : public VariableScope
+{
+  const VariableLayer* layer_;
+  VariableScope& parent_;
+  VariableLayer::Composed composed_;
+
+public:
+  LayeredScope(const VariableLayer* layer, VariableScope& parent) : layer_(layer), parent_(parent) {}
+
+  std::optional<VariableRef> Lookup(std::string_view name) override;
+};
@@ -0,0 +1,23 @@
+@echo off
+
+rem Tests link against make.lib, run ..\build.bat first.
+
+set CXX=clang++
+set CXXFLAGS=-std=c++23 -O2
+
+cd /d "%~dp0"
+
+if not exist ..\make.lib (
+    echo ..\make.lib not found, run build.bat in the repository root first
+    exit /b 1
+)
+
+echo Building tests...
+%CXX% %CXXFLAGS% build_session_test.cpp ..\make.lib -o build_session_test.exe
+if errorlevel 1 (
+    echo Build failed!
+    exit /b 1
+)
+
+echo Running tests...
+build_session_test.exe
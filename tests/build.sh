@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Tests link against libmake.a, run ../build.sh first.
+
+CXX="clang++"
+CXXFLAGS="-std=c++23 -O2"
+
+cd "$(dirname "$0")"
+
+if [ ! -f ../libmake.a ]; then
+    echo "../libmake.a not found, run build.sh in the repository root first"
+    exit 1
+fi
+
+echo Building tests...
+$CXX $CXXFLAGS build_session_test.cpp ../libmake.a -o build_session_test
+
+if [ $? -ne 0 ]; then
+    echo Build failed!
+    exit 1
+fi
+
+echo Running tests...
+./build_session_test
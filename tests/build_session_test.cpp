@@ -0,0 +1,85 @@
+// Regression checks for builds that reuse one BuildSession. Each case
+// writes a Makefile into a fresh directory under the system temp directory,
+// drives the session and checks the files its recipes wrote.
+//
+//   ./build_session_test
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../build_session.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  std::string ReadFile(const fs::path& path)
+  {
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+  }
+
+  // A kept graph must run its recipes with the target-specific variables
+  // of its own goals, also after another goal list gave the shared rules
+  // other ones.
+  bool KeptGraphKeepsItsVariables()
+  {
+    std::ofstream("Makefile") << "CFLAGS = base\n"
+                                 "all: x\n"
+                                 "other: x\n"
+                                 "all: CFLAGS = fromall\n"
+                                 "x:\n"
+                                 "\techo $(CFLAGS) >> log\n";
+    auto session = BuildSession::Load("Makefile");
+    session->Build({"all"});
+    session->Build({"other"});
+    session->Build({"all"});
+    return ReadFile("log") == "fromall\nbase\nfromall\n";
+  }
+
+  struct Case
+  {
+    const char* name;
+    std::function<bool()> run;
+  };
+}
+
+int main()
+{
+  const Case cases[] = {
+    {"kept graph keeps its variables", KeptGraphKeepsItsVariables},
+  };
+
+  fs::path start = fs::current_path();
+  int failures = 0;
+  for (const Case& test : cases)
+  {
+    fs::path dir = fs::temp_directory_path() / "build_session_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::current_path(dir);
+
+    bool ok = false;
+    try
+    {
+      ok = test.run();
+    }
+    catch (const std::exception& e)
+    {
+      std::cout << e.what() << "\n";
+    }
+    fs::current_path(start);
+    fs::remove_all(dir);
+
+    failures += !ok;
+    std::cout << (ok ? "ok\t" : "FAILED\t") << test.name << "\n";
+  }
+  return failures == 0 ? 0 : 1;
+}
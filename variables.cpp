@@ -0,0 +1,89 @@
+#include "variables.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+
+namespace
+{
+  // what $(MAKE) runs, which recipes then run in process
+  std::string CurrentExecutable()
+  {
+#ifdef __linux__
+    std::error_code ec;
+    std::filesystem::path self = std::filesystem::read_symlink("/proc/self/exe", ec);
+    if (!ec) return self.string();
+#endif
+    return "make";
+  }
+}
+
+VariableTable::VariableTable()
+{
+  vars_.emplace("SHELL", Variable{"/bin/sh", true, VariableOrigin::kDefault});
+  static const std::string make = CurrentExecutable();
+  vars_.emplace("MAKE", Variable{make, false, VariableOrigin::kDefault});
+}
+
+bool VariableTable::Set(const std::string& name, std::string value, bool recursive, VariableOrigin origin)
+{
+  // the environment value has to be known before it can be outranked
+  const Variable* existing = Find(name);
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (existing && existing->origin > origin)
+    return false;
+
+  Variable& var = vars_[name];
+  var.value = std::move(value);
+  var.recursive = recursive;
+  var.origin = origin;
+  return true;
+}
+
+const Variable* VariableTable::Find(std::string_view name)
+{
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = vars_.find(name);
+    if (it != vars_.end())
+      return &it->second;
+    if (missing_.contains(name))
+      return nullptr;
+  }
+
+  std::string key(name);
+  const char* env_value = std::getenv(key.c_str());
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (env_value == nullptr)
+  {
+    missing_.insert(std::move(key));
+    return nullptr;
+  }
+  // node-based, so the address stays valid when the table grows
+  return &vars_.try_emplace(std::move(key), Variable{env_value, true, VariableOrigin::kEnvironment}).first->second;
+}
+
+std::vector<std::pair<std::string, Variable>> VariableTable::Entries()
+{
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<std::pair<std::string, Variable>> entries(vars_.begin(), vars_.end());
+  std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+  return entries;
+}
+
+std::optional<VariableRef> VariableTable::Lookup(std::string_view name)
+{
+  const Variable* var = Find(name);
+  if (var == nullptr)
+    return std::nullopt;
+  return VariableRef{var->value, var->recursive};
+}
+
+VariableTable& DefaultVariables()
+{
+  static VariableTable variables;
+  return variables;
+}
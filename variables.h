@@ -0,0 +1,64 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "expander.h"
+
+// Where a value came from. A later origin is not replaced by an assignment
+// from an earlier one, so command-line values survive the Makefile and
+// `override` survives the command line.
+enum class VariableOrigin
+{
+  kDefault,
+  kEnvironment,
+  kFile,
+  kCommandLine,
+  kOverride,
+};
+
+struct Variable
+{
+  std::string value;
+  bool recursive = true;
+  VariableOrigin origin = VariableOrigin::kFile;
+
+  bool operator==(const Variable&) const = default;
+};
+
+// All global variables in one table, so a reference is one hash lookup.
+// Environment variables are imported when a name is first looked up
+// instead of being copied at startup.
+class VariableTable : public VariableScope
+{
+  struct NameHash
+  {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const {return std::hash<std::string_view>()(name);}
+  };
+
+  std::unordered_map<std::string, Variable, NameHash, std::equal_to<>> vars_;
+  // names known to be missing from the environment as well
+  std::unordered_set<std::string, NameHash, std::equal_to<>> missing_;
+  std::shared_mutex mutex_;
+
+public:
+  VariableTable();
+
+  // Returns false when the variable is held by a stronger origin.
+  bool Set(const std::string& name, std::string value, bool recursive, VariableOrigin origin);
+
+  const Variable* Find(std::string_view name);
+  // every variable set or imported so far, sorted by name
+  std::vector<std::pair<std::string, Variable>> Entries();
+  std::optional<VariableRef> Lookup(std::string_view name) override;
+};
+
+VariableTable& DefaultVariables();
@@ -0,0 +1,84 @@
+#include "vpath.h"
+
+#include "word_kernels.h"
+
+namespace
+{
+  // directory lists are separated by blanks or by the path separator
+  std::vector<std::string> SplitDirs(const std::string& dirs)
+  {
+#ifdef _WIN32
+    constexpr char kListSeparator = ';';
+#else
+    constexpr char kListSeparator = ':';
+#endif
+    std::vector<std::string> result;
+    std::string current;
+    for (char c : dirs)
+    {
+      if (c == kListSeparator || IsWordSpace(c))
+      {
+        if (!current.empty()) result.push_back(current);
+        current.clear();
+      }
+      else
+        current += c;
+    }
+    if (!current.empty()) result.push_back(current);
+    return result;
+  }
+
+  bool MatchVpathPattern(const std::string& pattern, const std::string& name)
+  {
+    size_t pct = pattern.find('%');
+    if (pct == std::string::npos)
+      return pattern == name;
+    return name.size() >= pattern.size() - 1 &&
+           name.compare(0, pct, pattern, 0, pct) == 0 &&
+           name.compare(name.size() - (pattern.size() - pct - 1), std::string::npos, pattern, pct + 1) == 0;
+  }
+
+  std::optional<std::string> FindIn(const std::vector<std::string>& search_dirs, const std::string& name,
+                                    DirectoryCache& dirs)
+  {
+    for (const std::string& dir : search_dirs)
+    {
+      std::string path = dir.back() == '/' ? dir + name : dir + '/' + name;
+      if (dirs.Exists(path))
+        return path;
+    }
+    return std::nullopt;
+  }
+}
+
+void VpathSearch::AddPattern(const std::string& pattern, const std::string& dirs)
+{
+  std::vector<std::string> split = SplitDirs(dirs);
+  if (!split.empty())
+    patterns_.emplace_back(pattern, std::move(split));
+}
+
+void VpathSearch::ClearPattern(const std::string& pattern)
+{
+  std::erase_if(patterns_, [&pattern](const auto& entry) { return entry.first == pattern; });
+}
+
+void VpathSearch::SetGeneral(const std::string& dirs)
+{
+  general_ = SplitDirs(dirs);
+}
+
+std::optional<std::string> VpathSearch::Find(const std::string& name, DirectoryCache& dirs) const
+{
+  // absolute names are never searched for
+  if (name.empty() || name[0] == '/')
+    return std::nullopt;
+
+  for (const auto& [pattern, search_dirs] : patterns_)
+  {
+    if (!MatchVpathPattern(pattern, name)) continue;
+    if (std::optional<std::string> found = FindIn(search_dirs, name, dirs))
+      return found;
+  }
+  return FindIn(general_, name, dirs);
+}
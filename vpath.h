@@ -0,0 +1,27 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dir_cache.h"
+
+// Directories searched for prerequisites that don't exist as written:
+// first the ones of matching `vpath pattern dirs` directives, in order,
+// then the ones listed in VPATH.
+class VpathSearch
+{
+  std::vector<std::pair<std::string, std::vector<std::string>>> patterns_;
+  std::vector<std::string> general_;
+
+public:
+  void AddPattern(const std::string& pattern, const std::string& dirs);
+  void ClearPattern(const std::string& pattern);
+  void ClearPatterns() {patterns_.clear();}
+  void SetGeneral(const std::string& dirs);
+
+  bool Empty() const {return patterns_.empty() && general_.empty();}
+  bool operator==(const VpathSearch&) const = default;
+
+  std::optional<std::string> Find(const std::string& name, DirectoryCache& dirs) const;
+};
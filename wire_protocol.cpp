@@ -0,0 +1,141 @@
+#include "wire_protocol.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  bool WriteAll(int fd, const char* data, size_t size)
+  {
+    while (size > 0)
+    {
+#if defined(MSG_NOSIGNAL)
+      auto written = send(fd, data, size, MSG_NOSIGNAL);
+#else
+      auto written = write(fd, data, static_cast<unsigned>(size));
+#endif
+      if (written <= 0) return false;
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  bool ReadAll(int fd, char* data, size_t size)
+  {
+    while (size > 0)
+    {
+      auto got = read(fd, data, static_cast<unsigned>(size));
+      if (got <= 0) return false;
+      data += got;
+      size -= static_cast<size_t>(got);
+    }
+    return true;
+  }
+}
+
+namespace wire
+{
+
+bool WriteFrame(int fd, FrameType type, const std::string& payload)
+{
+  uint32_t size = static_cast<uint32_t>(payload.size());
+  char header[5] = {
+    static_cast<char>(type),
+    static_cast<char>(size & 0xff),
+    static_cast<char>((size >> 8) & 0xff),
+    static_cast<char>((size >> 16) & 0xff),
+    static_cast<char>((size >> 24) & 0xff)
+  };
+  return WriteAll(fd, header, sizeof(header)) && WriteAll(fd, payload.data(), payload.size());
+}
+
+std::optional<Frame> ReadFrame(int fd)
+{
+  unsigned char header[5];
+  if (!ReadAll(fd, reinterpret_cast<char*>(header), sizeof(header)))
+    return std::nullopt;
+
+  uint32_t size = header[1] | (header[2] << 8) | (header[3] << 16) | (static_cast<uint32_t>(header[4]) << 24);
+
+  Frame frame{static_cast<FrameType>(header[0]), std::string(size, '\0')};
+  if (!ReadAll(fd, frame.payload.data(), size))
+    return std::nullopt;
+  return frame;
+}
+
+std::string PackFile(const FileBlob& blob)
+{
+  std::string payload = blob.path;
+  payload += '\0';
+  payload += std::to_string(static_cast<unsigned>(blob.perms));
+  payload += '\0';
+  payload += blob.content;
+  return payload;
+}
+
+std::optional<FileBlob> UnpackFile(const std::string& payload)
+{
+  size_t path_end = payload.find('\0');
+  if (path_end == std::string::npos) return std::nullopt;
+  size_t perms_end = payload.find('\0', path_end + 1);
+  if (perms_end == std::string::npos) return std::nullopt;
+
+  FileBlob blob;
+  blob.path = payload.substr(0, path_end);
+  try
+  {
+    blob.perms = static_cast<std::filesystem::perms>(
+      std::stoul(payload.substr(path_end + 1, perms_end - path_end - 1)));
+  }
+  catch (const std::exception&)
+  {
+    return std::nullopt;
+  }
+  blob.content = payload.substr(perms_end + 1);
+  return blob;
+}
+
+std::optional<FileBlob> LoadFile(const std::filesystem::path& path)
+{
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec))
+    return std::nullopt;
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return std::nullopt;
+
+  FileBlob blob;
+  blob.path = path.string();
+  blob.perms = std::filesystem::status(path, ec).permissions();
+  blob.content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return blob;
+}
+
+bool StoreFile(const std::filesystem::path& path, const FileBlob& blob)
+{
+  std::error_code ec;
+  if (path.has_parent_path())
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    return false;
+  file.write(blob.content.data(), static_cast<std::streamsize>(blob.content.size()));
+  file.close();
+
+  if (blob.perms != std::filesystem::perms::none)
+    std::filesystem::permissions(path, blob.perms, ec);
+  return static_cast<bool>(file);
+}
+
+} // namespace wire
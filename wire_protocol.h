@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+
+// Framing used between RemoteExecutor and the worker daemon. Every frame is a
+// one byte type, a 4 byte little-endian payload length and the payload.
+//
+// client -> worker: kCommand kDirectory kEnv* kInput* kOutput* kEnd
+// worker -> client: (kStdout | kStderr)* kFile* kExit
+namespace wire
+{
+
+enum class FrameType : char
+{
+  kCommand = 'C',
+  kDirectory = 'D',
+  kEnv = 'V',
+  kInput = 'I',
+  kOutput = 'O',
+  kEnd = 'G',
+  kStdout = '1',
+  kStderr = '2',
+  kFile = 'F',
+  kExit = 'X'
+};
+
+struct Frame
+{
+  FrameType type;
+  std::string payload;
+};
+
+struct FileBlob
+{
+  std::string path;
+  std::filesystem::perms perms = std::filesystem::perms::none;
+  std::string content;
+};
+
+bool WriteFrame(int fd, FrameType type, const std::string& payload);
+std::optional<Frame> ReadFrame(int fd);
+
+// kInput and kFile payloads are "path\0permissions\0content"
+std::string PackFile(const FileBlob& blob);
+std::optional<FileBlob> UnpackFile(const std::string& payload);
+
+std::optional<FileBlob> LoadFile(const std::filesystem::path& path);
+bool StoreFile(const std::filesystem::path& path, const FileBlob& blob);
+
+} // namespace wire
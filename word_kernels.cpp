@@ -0,0 +1,217 @@
+#include "word_kernels.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <unordered_set>
+
+#include "scan_kernels.h"
+
+namespace
+{
+  // end of string sorts before every byte
+  inline int RadixKey(std::string_view word, size_t depth)
+  {
+    return depth < word.size() ? static_cast<unsigned char>(word[depth]) + 1 : 0;
+  }
+
+  void RadixSort(std::string_view* begin, std::string_view* end, size_t depth, std::string_view* temp)
+  {
+    while (true)
+    {
+      size_t count = static_cast<size_t>(end - begin);
+      if (count < 32)
+      {
+        std::sort(begin, end, [depth](std::string_view lhs, std::string_view rhs) {
+          return lhs.substr(std::min(depth, lhs.size())) < rhs.substr(std::min(depth, rhs.size()));
+        });
+        return;
+      }
+
+      size_t counts[257] = {};
+      for (std::string_view* it = begin; it != end; ++it)
+        counts[RadixKey(*it, depth)]++;
+
+      // a shared prefix byte needs no distribution pass
+      int single_key = -1;
+      for (int key = 0; key < 257; ++key)
+        if (counts[key] == count) single_key = key;
+      if (single_key == 0) return;
+      if (single_key > 0)
+      {
+        depth++;
+        continue;
+      }
+
+      size_t offsets[257];
+      size_t sum = 0;
+      for (int key = 0; key < 257; ++key)
+      {
+        offsets[key] = sum;
+        sum += counts[key];
+      }
+      for (std::string_view* it = begin; it != end; ++it)
+        temp[offsets[RadixKey(*it, depth)]++] = *it;
+      std::copy(temp, temp + count, begin);
+
+      size_t start = counts[0];
+      for (int key = 1; key < 257; ++key)
+      {
+        if (counts[key] > 1)
+          RadixSort(begin + start, begin + start + counts[key], depth + 1, temp);
+        start += counts[key];
+      }
+      return;
+    }
+  }
+
+  bool MatchPercent(std::string_view prefix, std::string_view suffix, std::string_view word)
+  {
+    return word.size() >= prefix.size() + suffix.size() && word.starts_with(prefix) && word.ends_with(suffix);
+  }
+}
+
+void SplitWords(std::string_view text, std::vector<std::string_view>& words)
+{
+  const char* data = text.data();
+  size_t size = text.size();
+  size_t pos = 0;
+  size_t word_start = 0;
+  bool in_word = false;
+
+  // word starts are non-space bytes after a space, word ends the reverse;
+  // they alternate, so the lowest pending bit of the right kind is next
+  uint64_t prev_space = 1;
+  for (; pos + 64 <= size; pos += 64)
+  {
+    uint64_t space = ScanWhitespace64(data + pos);
+    uint64_t space_before = (space << 1) | prev_space;
+    uint64_t starts = ~space & space_before;
+    uint64_t ends = space & ~space_before;
+    prev_space = space >> 63;
+
+    while (true)
+    {
+      if (in_word)
+      {
+        if (ends == 0) break;
+        size_t end = pos + static_cast<size_t>(std::countr_zero(ends));
+        ends &= ends - 1;
+        words.emplace_back(data + word_start, end - word_start);
+        in_word = false;
+      }
+      else
+      {
+        if (starts == 0) break;
+        word_start = pos + static_cast<size_t>(std::countr_zero(starts));
+        starts &= starts - 1;
+        in_word = true;
+      }
+    }
+  }
+
+  for (; pos < size; ++pos)
+  {
+    bool space = IsWordSpace(data[pos]);
+    if (in_word && space)
+    {
+      words.emplace_back(data + word_start, pos - word_start);
+      in_word = false;
+    }
+    else if (!in_word && !space)
+    {
+      word_start = pos;
+      in_word = true;
+    }
+  }
+
+  if (in_word)
+    words.emplace_back(data + word_start, size - word_start);
+}
+
+std::vector<std::string_view> SplitWords(std::string_view text)
+{
+  std::vector<std::string_view> words;
+  SplitWords(text, words);
+  return words;
+}
+
+void SortUniqueWords(std::vector<std::string_view>& words)
+{
+  if (words.size() > 1)
+  {
+    std::vector<std::string_view> temp(words.size());
+    RadixSort(words.data(), words.data() + words.size(), 0, temp.data());
+  }
+  words.erase(std::unique(words.begin(), words.end()), words.end());
+}
+
+void FilterWords(const std::vector<std::string_view>& patterns, const std::vector<std::string_view>& words,
+                 bool keep, std::string& out)
+{
+  // literal patterns are answered by one hash lookup per word
+  std::unordered_set<std::string_view> literals;
+  literals.reserve(patterns.size());
+  std::vector<std::pair<std::string_view, std::string_view>> wildcards;
+  for (std::string_view pattern : patterns)
+  {
+    size_t pct = pattern.find('%');
+    if (pct == std::string_view::npos)
+      literals.insert(pattern);
+    else
+      wildcards.emplace_back(pattern.substr(0, pct), pattern.substr(pct + 1));
+  }
+
+  bool first = true;
+  for (std::string_view word : words)
+  {
+    bool matched = literals.contains(word);
+    for (size_t i = 0; !matched && i < wildcards.size(); ++i)
+      matched = MatchPercent(wildcards[i].first, wildcards[i].second, word);
+
+    if (matched != keep) continue;
+    if (!first) out += ' ';
+    first = false;
+    out.append(word);
+  }
+}
+
+void PatsubstWords(std::string_view pattern, std::string_view replacement,
+                   const std::vector<std::string_view>& words, std::string& out)
+{
+  size_t pattern_pct = pattern.find('%');
+  size_t replacement_pct = replacement.find('%');
+  std::string_view prefix = pattern.substr(0, std::min(pattern_pct, pattern.size()));
+  std::string_view suffix = pattern_pct == std::string_view::npos ? std::string_view() : pattern.substr(pattern_pct + 1);
+
+  size_t bytes = 0;
+  for (std::string_view word : words)
+    bytes += word.size();
+  out.reserve(out.size() + bytes + words.size() * (replacement.size() + 1));
+
+  bool first = true;
+  for (std::string_view word : words)
+  {
+    if (!first) out += ' ';
+    first = false;
+
+    bool matched = pattern_pct == std::string_view::npos ? word == pattern : MatchPercent(prefix, suffix, word);
+    if (!matched)
+    {
+      out.append(word);
+      continue;
+    }
+
+    // without a % in the pattern the replacement is used as it is
+    if (replacement_pct == std::string_view::npos || pattern_pct == std::string_view::npos)
+    {
+      out.append(replacement);
+      continue;
+    }
+
+    std::string_view stem = word.substr(prefix.size(), word.size() - prefix.size() - suffix.size());
+    out.append(replacement.substr(0, replacement_pct));
+    out.append(stem);
+    out.append(replacement.substr(replacement_pct + 1));
+  }
+}
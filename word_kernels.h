@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Word-list primitives behind $(filter), $(sort), $(patsubst) and friends.
+// They are written for lists of 100k+ file names: splitting scans 64 bytes
+// per step with the whitespace kernel of scan_kernels, and nothing is
+// quadratic.
+
+inline bool IsWordSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// appends the words of text to words, views point into text
+void SplitWords(std::string_view text, std::vector<std::string_view>& words);
+std::vector<std::string_view> SplitWords(std::string_view text);
+
+// sorts lexicographically and removes duplicates
+void SortUniqueWords(std::vector<std::string_view>& words);
+
+// keeps (or drops) the words matching any of the patterns, where a pattern
+// may contain one % wildcard
+void FilterWords(const std::vector<std::string_view>& patterns, const std::vector<std::string_view>& words,
+                 bool keep, std::string& out);
+
+// $(patsubst pattern,replacement,text) in a single pass into out
+void PatsubstWords(std::string_view pattern, std::string_view replacement,
+                   const std::vector<std::string_view>& words, std::string& out);
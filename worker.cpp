@@ -0,0 +1,260 @@
+#include "worker.h"
+
+#include <filesystem>
+#include <vector>
+
+#include "wire_protocol.h"
+#include "logger.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+#ifndef _WIN32
+  struct WorkerJob
+  {
+    std::string command;
+    std::string directory;
+    std::vector<std::string> env;
+    std::vector<wire::FileBlob> inputs;
+    std::vector<std::string> outputs;
+  };
+
+  bool ReadJob(int fd, WorkerJob* job)
+  {
+    using wire::FrameType;
+
+    while (std::optional<wire::Frame> frame = wire::ReadFrame(fd))
+    {
+      switch (frame->type)
+      {
+        case FrameType::kCommand: job->command = std::move(frame->payload); break;
+        case FrameType::kDirectory: job->directory = std::move(frame->payload); break;
+        case FrameType::kEnv: job->env.push_back(std::move(frame->payload)); break;
+        case FrameType::kOutput: job->outputs.push_back(std::move(frame->payload)); break;
+        case FrameType::kInput:
+        {
+          std::optional<wire::FileBlob> blob = wire::UnpackFile(frame->payload);
+          if (!blob) return false;
+          job->inputs.push_back(std::move(*blob));
+          break;
+        }
+        case FrameType::kEnd: return true;
+        default: return false;
+      }
+    }
+    return false;
+  }
+
+  // only relative paths that stay inside the job directory are mirrored
+  bool IsSandboxPath(const std::string& path)
+  {
+    fs::path normal = fs::path(path).lexically_normal();
+    return !normal.empty() && normal.is_relative() && *normal.begin() != "..";
+  }
+
+  int RunCommand(int client, const WorkerJob& job, const std::string& directory)
+  {
+    int out_pipe[2];
+    int err_pipe[2];
+    if (pipe(out_pipe) != 0) return 127;
+    if (pipe(err_pipe) != 0)
+    {
+      close(out_pipe[0]);
+      close(out_pipe[1]);
+      return 127;
+    }
+
+    std::vector<char*> envp;
+    for (const std::string& entry : job.env)
+      envp.push_back(const_cast<char*>(entry.c_str()));
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      dup2(out_pipe[1], STDOUT_FILENO);
+      dup2(err_pipe[1], STDERR_FILENO);
+      close(out_pipe[0]);
+      close(out_pipe[1]);
+      close(err_pipe[0]);
+      close(err_pipe[1]);
+      close(client);
+
+      if (!directory.empty() && chdir(directory.c_str()) != 0)
+        _exit(127);
+      execle("/bin/sh", "sh", "-c", job.command.c_str(), static_cast<char*>(nullptr), envp.data());
+      _exit(127);
+    }
+
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    if (pid < 0)
+    {
+      close(out_pipe[0]);
+      close(err_pipe[0]);
+      return 127;
+    }
+
+    pollfd fds[2] = {{out_pipe[0], POLLIN, 0}, {err_pipe[0], POLLIN, 0}};
+    const wire::FrameType types[2] = {wire::FrameType::kStdout, wire::FrameType::kStderr};
+    int open_pipes = 2;
+    char buffer[65536];
+
+    while (open_pipes > 0)
+    {
+      if (poll(fds, 2, -1) < 0)
+      {
+        if (errno == EINTR) continue;
+        break;
+      }
+
+      for (int i = 0; i < 2; ++i)
+      {
+        if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+
+        ssize_t got = read(fds[i].fd, buffer, sizeof(buffer));
+        if (got > 0)
+        {
+          wire::WriteFrame(client, types[i], std::string(buffer, static_cast<size_t>(got)));
+          continue;
+        }
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        open_pipes--;
+      }
+    }
+
+    for (pollfd& pfd : fds)
+      if (pfd.fd >= 0) close(pfd.fd);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+      if (errno != EINTR) return 127;
+
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 127;
+  }
+
+  void ServeClient(int client, const std::string& work_root)
+  {
+    WorkerJob job;
+    if (!ReadJob(client, &job))
+      return;
+
+    std::string directory = job.directory;
+    bool sandbox = !work_root.empty();
+    std::error_code ec;
+
+    if (sandbox)
+    {
+      fs::create_directories(work_root, ec);
+      std::string pattern = (fs::path(work_root) / "job.XXXXXX").string();
+      if (mkdtemp(pattern.data()) == nullptr)
+      {
+        wire::WriteFrame(client, wire::FrameType::kStderr, "Cannot create job directory in " + work_root + "\n");
+        wire::WriteFrame(client, wire::FrameType::kExit, "127");
+        return;
+      }
+      directory = pattern;
+
+      for (const wire::FileBlob& input : job.inputs)
+        if (IsSandboxPath(input.path))
+          wire::StoreFile(fs::path(directory) / input.path, input);
+    }
+
+    int status = RunCommand(client, job, directory);
+
+    if (sandbox)
+    {
+      for (const std::string& output : job.outputs)
+      {
+        if (!IsSandboxPath(output)) continue;
+
+        std::optional<wire::FileBlob> blob = wire::LoadFile(fs::path(directory) / output);
+        if (!blob) continue;
+        blob->path = output;
+        wire::WriteFrame(client, wire::FrameType::kFile, wire::PackFile(*blob));
+      }
+      fs::remove_all(directory, ec);
+    }
+
+    wire::WriteFrame(client, wire::FrameType::kExit, std::to_string(status));
+  }
+#endif
+}
+
+int RunWorker(const std::string& socket_path, const std::string& work_root)
+{
+#ifdef _WIN32
+  (void)socket_path;
+  (void)work_root;
+  loging::LogError("Worker mode is not supported on this platform");
+  return 1;
+#else
+  sockaddr_un addr{};
+  if (socket_path.size() >= sizeof(addr.sun_path))
+  {
+    loging::LogError("Socket path is too long: " + socket_path);
+    return 1;
+  }
+  addr.sun_family = AF_UNIX;
+  socket_path.copy(addr.sun_path, socket_path.size());
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0)
+  {
+    loging::LogError("Cannot create worker socket");
+    return 1;
+  }
+
+  unlink(socket_path.c_str());
+  if (bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server, SOMAXCONN) != 0)
+  {
+    loging::LogError("Cannot listen on " + socket_path);
+    close(server);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);
+  loging::LogInfo("Worker is listening on " + socket_path);
+
+  while (true)
+  {
+    int client = accept(server, nullptr, nullptr);
+    if (client < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      loging::LogError("Worker stopped accepting connections");
+      break;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(server);
+      signal(SIGCHLD, SIG_DFL);
+      ServeClient(client, work_root);
+      close(client);
+      _exit(0);
+    }
+    close(client);
+  }
+
+  close(server);
+  return 1;
+#endif
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Serves RemoteExecutor clients on a Unix-domain socket, one forked process
+// per connection. With an empty work_root commands run in the directory the
+// client sent; otherwise each one runs in a fresh directory below work_root
+// that holds only its declared inputs, and its outputs are sent back.
+int RunWorker(const std::string& socket_path, const std::string& work_root);